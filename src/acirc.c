@@ -1,5 +1,8 @@
 #include "acirc.h"
+#include "cse.h"
+#include "stats.h"
 #include "utils.h"
+#include "walk.h"
 #include "commands/outputs.h"
 #include "commands/test.h"
 #include "commands/secrets.h"
@@ -9,9 +12,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
-extern int yyparse(acirc *);
-extern FILE *yyin;
+typedef void *yyscan_t;
+extern int yylex_init_extra(acirc_arena_t *scratch, yyscan_t *scanner);
+extern int yylex_destroy(yyscan_t scanner);
+extern void acirc_scan_reset(FILE *fp, yyscan_t scanner);
+extern int yyparse(yyscan_t scanner, acirc *c);
+
+struct acirc_parser {
+    yyscan_t scanner;
+    acirc_arena_t scratch;      /* tokens and lists of the current line */
+};
 
 acirc_memo * acirc_memo_new(const acirc *c)
 {
@@ -109,21 +121,33 @@ void acirc_verbose(uint32_t verbose)
 static void acirc_init_gates(acirc_gates_t *g)
 {
     g->_alloc = 2;
-    g->gates = acirc_calloc(g->_alloc, sizeof(acirc_gate_t));
+    g->ops = acirc_calloc(g->_alloc, sizeof g->ops[0]);
+    g->nargs = acirc_calloc(g->_alloc, sizeof g->nargs[0]);
+    g->offsets = acirc_calloc(g->_alloc, sizeof g->offsets[0]);
+    g->_args_alloc = 4;
+    g->args = acirc_calloc(g->_args_alloc, sizeof g->args[0]);
+    g->_args_n = 0;
+    g->ext = NULL;
+    g->_ext_n = 0;
+    g->_map = NULL;
+    g->_map_len = 0;
     g->n = 0;
 }
 
-static void acirc_clear_gates(acirc_gates_t *g, size_t n)
+static void acirc_clear_gates(acirc_gates_t *g)
 {
-    if (g->gates) {
-        for (size_t i = 0; i < n; ++i) {
-            free(g->gates[i].args);
-            if (g->gates[i].name)
-                free(g->gates[i].name);
-            if (g->gates[i].external)
-                free(g->gates[i].external);
-        }
-        free(g->gates);
+    for (size_t i = 0; i < g->_ext_n; ++i) {
+        if (g->ext[i].external)
+            free(g->ext[i].external);
+    }
+    free(g->ext);
+    if (g->_map) {
+        munmap(g->_map, g->_map_len);
+    } else {
+        free(g->ops);
+        free(g->nargs);
+        free(g->offsets);
+        free(g->args);
     }
 }
 
@@ -134,18 +158,13 @@ static void acirc_init_tests(acirc_tests_t *t)
     t->n = 0;
 }
 
+/* the test vectors themselves live in the arena */
 static void acirc_clear_tests(acirc_tests_t *t)
 {
-    if (t->inps) {
-        for (size_t i = 0; i < t->n; ++i)
-            free(t->inps[i]);
+    if (t->inps)
         free(t->inps);
-    }
-    if (t->outs) {
-        for (size_t i = 0; i < t->n; ++i)
-            free(t->outs[i]);
+    if (t->outs)
         free(t->outs);
-    }
 }
 
 static void acirc_init_outputs(acirc_outputs_t *o)
@@ -166,12 +185,6 @@ static void acirc_init_secrets(acirc_secrets_t *s)
     s->list = NULL;
 }
 
-static void acirc_clear_secrets(acirc_secrets_t *s)
-{
-    if (s->list)
-        free(s->list);
-}
-
 static void acirc_init_consts(acirc_consts_t *c)
 {
     c->_alloc = 2;
@@ -185,6 +198,18 @@ static void acirc_clear_consts(acirc_consts_t *c)
         free(c->buf);
 }
 
+static void acirc_init_extras(acirc_extras_t *e)
+{
+    e->extras = NULL;
+    e->n = 0;
+}
+
+static void acirc_clear_extras(acirc_extras_t *e)
+{
+    if (e->extras)
+        free(e->extras);
+}
+
 void acirc_add_extra(acirc_extras_t *e, const char *name, void *data)
 {
     const size_t last = e->n++;
@@ -203,20 +228,61 @@ void acirc_init(acirc *c)
     acirc_init_tests(&c->tests);
     acirc_init_commands(&c->commands);
     acirc_init_extgates(&c->extgates);
+    acirc_init_extras(&c->extras);
+    acirc_arena_init(&c->arena);
+    c->fanout = NULL;
+    c->walk = walk_new();
+    c->stats = stats_new();
+    c->hashcons = NULL;
 }
 
 void acirc_clear(acirc *c)
 {
-    acirc_clear_gates(&c->gates, acirc_nrefs(c));
+    acirc_invalidate(c);
+    acirc_clear_gates(&c->gates);
     acirc_clear_outputs(&c->outputs);
-    acirc_clear_secrets(&c->secrets);
     acirc_clear_tests(&c->tests);
     acirc_clear_consts(&c->consts);
     acirc_clear_commands(&c->commands);
     acirc_clear_extgates(&c->extgates);
+    acirc_clear_extras(&c->extras);
+    acirc_arena_clear(&c->arena);
+    walk_free(c->walk);
+    stats_free(c->stats);
+    cse_free(c->hashcons);
+}
+
+acirc_parser * acirc_parser_new(void)
+{
+    acirc_parser *p = acirc_calloc(1, sizeof p[0]);
+    acirc_arena_init(&p->scratch);
+    if (yylex_init_extra(&p->scratch, &p->scanner) != 0) {
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+void acirc_parser_free(acirc_parser *p)
+{
+    if (p) {
+        yylex_destroy(p->scanner);
+        acirc_arena_clear(&p->scratch);
+        free(p);
+    }
 }
 
 acirc * acirc_fread(acirc *c, FILE *fp)
+{
+    acirc_parser *p;
+    if ((p = acirc_parser_new()) == NULL)
+        return NULL;
+    c = acirc_fread_ctx(p, c, fp);
+    acirc_parser_free(p);
+    return c;
+}
+
+acirc * acirc_fread_ctx(acirc_parser *p, acirc *c, FILE *fp)
 {
     bool mine = false;
     if (c == NULL) {
@@ -224,8 +290,9 @@ acirc * acirc_fread(acirc *c, FILE *fp)
         acirc_init(c);
         mine = true;
     }
-    yyin = fp;
-    if (yyparse(c) != 0) {
+    acirc_scan_reset(fp, p->scanner);
+    acirc_arena_reset(&p->scratch);
+    if (yyparse(p->scanner, c) != 0) {
         /* acirc_clear(c); */
         if (mine)
             free(c);
@@ -238,18 +305,18 @@ int acirc_fwrite(const acirc *c, FILE *fp)
 {
     acirc_add_tests_to_file(&c->tests, c->ninputs, c->outputs.n, fp);
     for (size_t i = 0; i < acirc_nrefs(c); ++i) {
-        const acirc_gate_t *gate = &c->gates.gates[i];
-        switch (gate->op) {
+        const acirc_gate_t gate = acirc_gate(c, i);
+        switch (gate.op) {
         case OP_INPUT:
-            fprintf(fp, "%ld input %ld\n", i, gate->args[0]);
+            fprintf(fp, "%ld input %ld\n", i, (long) gate.args[0]);
             break;
         case OP_CONST:
-            fprintf(fp, "%ld const %ld\n", i, gate->args[1]);
+            fprintf(fp, "%ld const %ld\n", i, (long) gate.args[1]);
             break;
         case OP_ADD: case OP_SUB: case OP_MUL: case OP_SET:
-            fprintf(fp, "%ld %s", i, acirc_op2str(gate->op));
-            for (size_t j = 0; j < gate->nargs; ++j) {
-                fprintf(fp, " %ld", gate->args[j]);
+            fprintf(fp, "%ld %s", i, acirc_op2str(gate.op));
+            for (size_t j = 0; j < gate.nargs; ++j) {
+                fprintf(fp, " %ld", (long) gate.args[j]);
             }
             fprintf(fp, "\n");
             break;
@@ -265,57 +332,73 @@ int acirc_fwrite(const acirc *c, FILE *fp)
 ////////////////////////////////////////////////////////////////////////////////
 // acirc evaluation
 
-int acirc_eval(acirc *c, acircref root, int *xs)
-{
-    acircref topo[acirc_nrefs(c)];
-    acircref vals[acirc_nrefs(c)];
-    const size_t n = acirc_topological_order(topo, c, root);
+typedef struct {
+    const int *xs;
+    acircref *vals;
+    bool err;
+} eval_walk_t;
 
-    for (size_t i = 0; i < n; i++) {
-        const acircref ref = topo[i];
-        const acirc_gate_t *gate = &c->gates.gates[ref];
-        switch (gate->op) {
-        case OP_INPUT:
-            vals[ref] = xs[gate->args[0]];
-            break;
-        case OP_CONST:
-            vals[ref] = gate->args[1];
-            break;
-        case OP_ADD:
-            vals[ref] = 0;
-            for (size_t j = 0; j < gate->nargs; ++j) {
-                vals[ref] += vals[gate->args[j]];
-            }
-            break;
-        case OP_SUB:
-            assert(gate->nargs >= 1);
-            vals[ref] = vals[gate->args[0]];
-            for (size_t j = 1; j < gate->nargs; ++j) {
-                vals[ref] -= vals[gate->args[j]];
-            }
-            break;
-        case OP_MUL:
-            vals[ref] = 1;
-            for (size_t j = 0; j < gate->nargs; ++j) {
-                vals[ref] *= vals[gate->args[j]];
-            }
-            break;
-        case OP_SET:
-            vals[ref] = vals[gate->args[0]];
-            break;
-        case OP_EXTERNAL:
-            vals[ref] = acirc_eval_extgate(&c->extgates, gate);
-            if (vals[ref] == -1)
-                return -1;      /* XXX: not a good way to report an error */
-            break;
+static void eval_fn(void *data, const acirc *c, acircref ref)
+{
+    eval_walk_t *e = data;
+    acircref *vals = e->vals;
+    const acirc_gate_t gate = acirc_gate(c, ref);
+    switch (gate.op) {
+    case OP_INPUT:
+        vals[ref] = e->xs[gate.args[0]];
+        break;
+    case OP_CONST:
+        vals[ref] = gate.args[1];
+        break;
+    case OP_ADD:
+        vals[ref] = 0;
+        for (size_t j = 0; j < gate.nargs; ++j) {
+            vals[ref] += vals[gate.args[j]];
         }
+        break;
+    case OP_SUB:
+        assert(gate.nargs >= 1);
+        vals[ref] = vals[gate.args[0]];
+        for (size_t j = 1; j < gate.nargs; ++j) {
+            vals[ref] -= vals[gate.args[j]];
+        }
+        break;
+    case OP_MUL:
+        vals[ref] = 1;
+        for (size_t j = 0; j < gate.nargs; ++j) {
+            vals[ref] *= vals[gate.args[j]];
+        }
+        break;
+    case OP_SET:
+        vals[ref] = vals[gate.args[0]];
+        break;
+    case OP_EXTERNAL:
+        vals[ref] = acirc_eval_extgate(&c->extgates, &gate);
+        if (vals[ref] == -1)
+            e->err = true;
+        break;
     }
-    return vals[root];
+}
+
+int acirc_eval(acirc *c, acircref root, int *xs)
+{
+    walk_t *w = walk_acquire(c);
+    eval_walk_t e = { .xs = xs, .err = false };
+    int ret;
+
+    walk_begin(w, c);
+    e.vals = w->refs;
+    walk_from(w, c, root, NULL, eval_fn, &e);
+    /* XXX: not a good way to report an error */
+    ret = e.err ? -1 : e.vals[root];
+    walk_release(c, w);
+    return ret;
 }
 
 bool acirc_ensure(acirc *c)
 {
     const acirc_tests_t *tests = &c->tests;
+    acirc_plan *plan = acirc_plan_new(c);
     int res[c->outputs.n];
     bool ok  = true;
 
@@ -323,10 +406,57 @@ bool acirc_ensure(acirc *c)
         printf("running acirc tests...\n");
 
     for (size_t test_num = 0; test_num < tests->n; test_num++) {
+        bool test_ok = acirc_eval_all(plan, tests->inps[test_num], res) == ACIRC_OK;
+        for (size_t i = 0; i < c->outputs.n; i++)
+            test_ok = test_ok && (res[i] == tests->outs[test_num][i]);
+
+        if (g_verbose) {
+            if (!test_ok)
+                printf("\033[1;41m");
+            printf("test %lu input=", test_num);
+            array_printstring_rev(tests->inps[test_num], c->ninputs);
+            printf(" expected=");
+            array_printstring_rev(tests->outs[test_num], c->outputs.n);
+            printf(" got=");
+            array_printstring_rev(res, c->outputs.n);
+            if (!test_ok)
+                printf("\033[0m");
+            puts("");
+        }
+
+        ok = ok && test_ok;
+    }
+    acirc_plan_free(plan);
+    return ok;
+}
+
+bool acirc_ensure_u64(acirc *c, uint64_t modulus)
+{
+    const acirc_tests_t *tests = &c->tests;
+    const size_t n = tests->n;
+    acirc_plan *plan = acirc_plan_new(c);
+    uint64_t *xs = acirc_calloc(c->ninputs * n + 1, sizeof xs[0]);
+    uint64_t *ys = acirc_calloc(c->outputs.n * n + 1, sizeof ys[0]);
+    int res[c->outputs.n];
+    bool evaluated, ok;
+
+    if (g_verbose)
+        printf("running acirc tests mod %lu...\n", (unsigned long) modulus);
+
+    /* all tests at once, one lane each */
+    for (size_t test_num = 0; test_num < n; test_num++)
+        for (size_t i = 0; i < c->ninputs; i++)
+            xs[i * n + test_num] = tests->inps[test_num][i];
+    evaluated = acirc_eval_u64_mod_batch(plan, xs, ys, n, modulus) == ACIRC_OK;
+    ok = evaluated;
+
+    for (size_t test_num = 0; evaluated && test_num < n; test_num++) {
         bool test_ok = true;
         for (size_t i = 0; i < c->outputs.n; i++) {
-            res[i] = acirc_eval(c, c->outputs.buf[i], tests->inps[test_num]);
-            test_ok = test_ok && (res[i] == tests->outs[test_num][i]);
+            const long m = (long) modulus;
+            const uint64_t y = ys[i * n + test_num];
+            test_ok = test_ok && y == (uint64_t) ((tests->outs[test_num][i] % m + m) % m);
+            res[i] = (int) y;
         }
 
         if (g_verbose) {
@@ -345,290 +475,195 @@ bool acirc_ensure(acirc *c)
 
         ok = ok && test_ok;
     }
+    free(xs);
+    free(ys);
+    acirc_plan_free(plan);
     return ok;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // acirc info calculations
 
-static size_t acirc_depth_helper(const acirc *c, acircref ref, size_t *memo, bool *seen)
+/* Each analysis computes one value per ref from the values of its arguments,
+ * over a post-order walk.  Values go to the walk's scratch, or to a row of an
+ * acirc_memo if one was given. */
+typedef struct {
+    size_t *vals;
+    acircref *memo;
+    bool *exists;
+    acircref id;
+} info_walk_t;
+
+static inline size_t info_get(const info_walk_t *info, acircref ref)
 {
-    if (seen[ref])
-        return memo[ref];
+    return info->memo ? (size_t) info->memo[ref] : info->vals[ref];
+}
 
-    const acirc_gate_t *gate = &c->gates.gates[ref];
+static inline void info_set(info_walk_t *info, acircref ref, size_t val)
+{
+    if (info->memo) {
+        info->memo[ref] = val;
+        info->exists[ref] = true;
+    } else {
+        info->vals[ref] = val;
+    }
+}
+
+/* the maximum of fn over the cones of roots */
+static size_t info_max(const acirc *c, const acircref *roots, size_t n,
+                       walk_fn fn, acircref id)
+{
+    walk_t *w = walk_acquire(c);
+    info_walk_t info = { .memo = NULL, .exists = NULL, .id = id };
+    size_t ret = 0;
+
+    walk_begin(w, c);
+    info.vals = w->vals;
+    for (size_t i = 0; i < n; i++) {
+        walk_from(w, c, roots[i], NULL, fn, &info);
+        if (info_get(&info, roots[i]) > ret)
+            ret = info_get(&info, roots[i]);
+    }
+    walk_release(c, w);
+    return ret;
+}
+
+/* fn at ref, memoized in row of memo if given */
+static size_t info_memo(const acirc *c, acircref ref, acirc_memo *memo,
+                        size_t row, walk_fn fn, acircref id)
+{
+    walk_t *w = walk_acquire(c);
+    info_walk_t info = { .memo = NULL, .exists = NULL, .id = id };
+    size_t ret;
+
+    walk_begin(w, c);
+    info.vals = w->vals;
+    if (memo) {
+        info.memo = memo->memo[row];
+        info.exists = memo->exists[row];
+    }
+    walk_from(w, c, ref, info.exists, fn, &info);
+    ret = info_get(&info, ref);
+    walk_release(c, w);
+    return ret;
+}
+
+static void depth_fn(void *data, const acirc *c, acircref ref)
+{
+    info_walk_t *info = data;
+    const acirc_gate_t gate = acirc_gate(c, ref);
     size_t ret = 0;
 
-    switch (gate->op) {
+    switch (gate.op) {
     case OP_INPUT: case OP_CONST:
         ret = 0;
         break;
     case OP_ADD: case OP_SUB: case OP_MUL:
-        for (size_t i = 0; i < gate->nargs; ++i) {
-            size_t tmp = acirc_depth_helper(c, gate->args[i], memo, seen);
+        for (size_t i = 0; i < gate.nargs; ++i) {
+            size_t tmp = info_get(info, gate.args[i]);
             ret = ret > tmp ? ret : tmp;
         }
         ret++;
         break;
     case OP_SET:
-        ret = acirc_depth_helper(c, gate->args[0], memo, seen);
+        ret = info_get(info, gate.args[0]);
         break;
     default:
         abort();
     }
-
-    seen[ref] = true;
-    memo[ref] = ret;
-    return ret;
+    info_set(info, ref, ret);
 }
 
 size_t acirc_depth(const acirc *c, acircref ref)
 {
-    size_t memo[acirc_nrefs(c)];
-    bool   seen[acirc_nrefs(c)];
-    memset(seen, '\0', sizeof seen);
-    return acirc_depth_helper(c, ref, memo, seen);
+    return info_max(c, &ref, 1, depth_fn, 0);
 }
 
-size_t acirc_max_depth(const acirc *c)
+static void degree_fn(void *data, const acirc *c, acircref ref)
 {
-    size_t memo[acirc_nrefs(c)];
-    bool   seen[acirc_nrefs(c)];
-    memset(seen, '\0', sizeof seen);
+    info_walk_t *info = data;
+    const acirc_gate_t gate = acirc_gate(c, ref);
     size_t ret = 0;
-    for (size_t i = 0; i < c->outputs.n; i++) {
-        size_t tmp = acirc_depth_helper(c, c->outputs.buf[i], memo, seen);
-        if (tmp > ret)
-            ret = tmp;
-    }
-    return ret;
-}
-
-static size_t acirc_degree_helper(const acirc *c, acircref ref, size_t *memo, bool *seen)
-{
-    if (seen[ref])
-        return memo[ref];
 
-    size_t ret = 0;
-    const acirc_gate_t *gate = &c->gates.gates[ref];
-    switch (gate->op) {
+    switch (gate.op) {
     case OP_INPUT: case OP_CONST:
         ret = 1;
         break;
     case OP_ADD: case OP_SUB: case OP_MUL:
-        for (size_t i = 0; i < gate->nargs; ++i) {
-            size_t tmp = acirc_degree_helper(c, gate->args[i], memo, seen);
-            if (gate->op == OP_MUL)
+        for (size_t i = 0; i < gate.nargs; ++i) {
+            size_t tmp = info_get(info, gate.args[i]);
+            if (gate.op == OP_MUL)
                 ret += tmp;
             else
                 ret = (ret > tmp) ? ret : tmp;
         }
         break;
     case OP_SET:
-        ret = acirc_degree_helper(c, gate->args[0], memo, seen);
+        ret = info_get(info, gate.args[0]);
         break;
     case OP_EXTERNAL:
         abort();
     }
-
-    seen[ref] = true;
-    memo[ref] = ret;
-    return ret;
+    info_set(info, ref, ret);
 }
 
 size_t acirc_degree(const acirc *c, acircref ref)
 {
-    size_t memo[acirc_nrefs(c)];
-    bool   seen[acirc_nrefs(c)];
-    memset(seen, '\0', sizeof seen);
-    return acirc_degree_helper(c, ref, memo, seen);
+    return info_max(c, &ref, 1, degree_fn, 0);
 }
 
-size_t acirc_max_degree(const acirc *c)
+/* degree in input id, or in the constants if id is -1 */
+static void var_degree_fn(void *data, const acirc *c, acircref ref)
 {
-    size_t memo[acirc_nrefs(c)];
-    bool   seen[acirc_nrefs(c)];
-    memset(seen, '\0', sizeof seen);
-    size_t ret = 0;
-    for (size_t i = 0; i < c->outputs.n; i++) {
-        size_t tmp = acirc_degree_helper(c, c->outputs.buf[i], memo, seen);
-        if (tmp > ret)
-            ret = tmp;
-    }
-    return ret;
-}
-
-size_t acirc_var_degree(const acirc *c, acircref ref, acircref id, acirc_memo *memo)
-{
-    bool alloc = false;
-    if (memo == NULL) {
-        memo = acirc_memo_new(c);
-        alloc = true;
-    } else if (memo->exists[id][ref])
-        return memo->memo[id][ref];
-
-    const acirc_gate_t *gate = &c->gates.gates[ref];
+    info_walk_t *info = data;
+    const acirc_gate_t gate = acirc_gate(c, ref);
     size_t res = 0;
-    switch (gate->op) {
-    case OP_INPUT:
-        res = (gate->args[0] == id) ? 1 : 0;
-        break;
-    case OP_CONST:
-        res = 0;
-        break;
-    case OP_ADD: case OP_SUB: case OP_MUL: {
-        for (size_t i = 0; i < gate->nargs; ++i) {
-            size_t tmp = acirc_var_degree(c, gate->args[i], id, memo);
-            if (gate->op == OP_MUL)
-                res += tmp;
-            else
-                res = res > tmp ? res : tmp;
-        }
-        if (gate->op != OP_MUL) {
-            memo->memo[id][ref] = res;
-            memo->exists[id][ref] = true;
-        }
-        break;
-    }
-    case OP_SET: {
-        res = acirc_var_degree(c, gate->args[0], id, memo);
-        memo->memo[id][ref] = res;
-        memo->exists[id][ref] = true;
-        break;
-    }
-    default:
-        abort();
-    }
-    if (alloc)
-        acirc_memo_free(memo, c);
-    return res;
-}
 
-size_t acirc_max_var_degree(const acirc *c, acircref id)
-{
-    size_t ret = 0;
-    acirc_memo *memo = acirc_memo_new(c);
-    for (size_t i = 0; i < c->outputs.n; i++) {
-        size_t tmp = acirc_var_degree(c, c->outputs.buf[i], id, memo);
-        if (tmp > ret)
-            ret = tmp;
-    }
-    acirc_memo_free(memo, c);
-    return ret;
-}
-
-size_t acirc_const_degree(const acirc *c, acircref ref, acirc_memo *memo)
-{
-    bool alloc = false;
-    if (memo == NULL) {
-        memo = acirc_memo_new(c);
-        alloc = true;
-    } else if (memo->exists[c->ninputs][ref]) {
-        return memo->memo[c->ninputs][ref];
-    }
-
-    const acirc_gate_t *gate = &c->gates.gates[ref];
-    size_t res = 0;
-    switch (gate->op) {
+    switch (gate.op) {
     case OP_INPUT:
-        res = 0;
+        res = (gate.args[0] == info->id) ? 1 : 0;
         break;
     case OP_CONST:
-        res = 1;
+        res = (info->id == -1) ? 1 : 0;
         break;
-    case OP_ADD: case OP_SUB: case OP_MUL: {
-        for (size_t i = 0; i < gate->nargs; ++i) {
-            size_t tmp = acirc_const_degree(c, gate->args[i], memo);
-            if (gate->op == OP_MUL)
+    case OP_ADD: case OP_SUB: case OP_MUL:
+        for (size_t i = 0; i < gate.nargs; ++i) {
+            size_t tmp = info_get(info, gate.args[i]);
+            if (gate.op == OP_MUL)
                 res += tmp;
             else
                 res = res > tmp ? res : tmp;
         }
-        if (gate->op != OP_MUL) {
-            memo->memo[c->ninputs][ref] = res;
-            memo->exists[c->ninputs][ref] = true;
-        }
         break;
-    }
     case OP_SET:
-        res = acirc_const_degree(c, gate->args[0], memo);
+        res = info_get(info, gate.args[0]);
         break;
     default:
         abort();
     }
-    if (alloc)
-        acirc_memo_free(memo, c);
-    return res;
+    info_set(info, ref, res);
 }
 
-size_t acirc_max_const_degree(const acirc *c)
-{
-    size_t ret = 0;
-    acirc_memo *memo = acirc_memo_new(c);
-    for (size_t i = 0; i < c->outputs.n; i++) {
-        size_t tmp = acirc_const_degree(c, c->outputs.buf[i], memo);
-        if (tmp > ret)
-            ret = tmp;
-    }
-    acirc_memo_free(memo, c);
-    return ret;
-}
-
-size_t acirc_delta(const acirc *c)
+size_t acirc_var_degree(const acirc *c, acircref ref, acircref id, acirc_memo *memo)
 {
-    size_t delta = acirc_max_const_degree(c);
-    for (size_t i = 0; i < c->ninputs; i++) {
-        delta += acirc_max_var_degree(c, i);
-    }
-    return delta;
+    return info_memo(c, ref, memo, id, var_degree_fn, id);
 }
 
-static size_t acirc_total_degree_helper(const acirc *c, acircref ref, acirc_memo *memo)
+size_t acirc_max_var_degree(const acirc *c, acircref id)
 {
-    if (memo->exists[c->ninputs][ref])
-        return memo->memo[c->ninputs][ref];
-
-    const acirc_gate_t *gate = &c->gates.gates[ref];
-    switch (gate->op) {
-    case OP_INPUT: case OP_CONST:
-        return 1;
-    case OP_ADD: case OP_SUB: case OP_MUL: {
-        size_t res = 0;
-        for (size_t i = 0; i < gate->nargs; ++i) {
-            res += acirc_total_degree_helper(c, gate->args[i], memo);
-        }
-        memo->memo[c->ninputs][ref] = res;
-        memo->exists[c->ninputs][ref] = true;
-        return res;
-    }
-    case OP_SET:
-        return acirc_total_degree_helper(c, gate->args[0], memo);
-    default:
-        abort();
-    }
+    if (id >= 0 && (size_t) id < c->ninputs)
+        return acirc_stats_degrees(c, NULL)[id];
+    return info_max(c, c->outputs.buf, c->outputs.n, var_degree_fn, id);
 }
 
-size_t acirc_max_total_degree(const acirc *c)
+size_t acirc_const_degree(const acirc *c, acircref ref, acirc_memo *memo)
 {
-    acirc_memo *memo = acirc_memo_new(c);
-    size_t ret = 0;
-    for (size_t i = 0; i < c->outputs.n; ++i) {
-        size_t tmp = acirc_total_degree_helper(c, c->outputs.buf[i], memo);
-        if (tmp > ret)
-            ret = tmp;
-    }
-    acirc_memo_free(memo, c);
-    return ret;
+    return info_memo(c, ref, memo, c->ninputs, var_degree_fn, -1);
 }
 
-size_t acirc_nmuls(const acirc *c)
+size_t acirc_max_const_degree(const acirc *c)
 {
-    size_t nmuls = 0;
-    for (size_t i = 0; i < acirc_nrefs(c); i++) {
-        if (c->gates.gates[i].op == OP_MUL)
-            nmuls++;
-    }
-    return nmuls;
+    return acirc_stats_degrees(c, NULL)[c->ninputs];
 }
 
 acirc_operation acirc_str2op(char *s)
@@ -663,40 +698,56 @@ char * acirc_op2str(acirc_operation op)
     }
 }
 
-char *
-acirc_to_sage(const acirc *c, acircref ref)
+static void sage_fn(void *data, const acirc *c, acircref ref)
 {
+    char **strs = data;
     char *str;
     size_t size;
-    const acirc_gate_t *gate = &c->gates.gates[ref];
-    switch (gate->op) {
+    const acirc_gate_t gate = acirc_gate(c, ref);
+    switch (gate.op) {
     case OP_INPUT:
         size = 1024;
         str = calloc(size, sizeof str[0]);
-        snprintf(str, size, "var('x%ld')", gate->args[0]);
+        snprintf(str, size, "var('x%ld')", (long) gate.args[0]);
         break;
     case OP_CONST:
         size = 1024;
         str = calloc(size, sizeof str[0]);
-        snprintf(str, size, "%ld", gate->args[1]);
+        snprintf(str, size, "%ld", (long) gate.args[1]);
         break;
     case OP_ADD: case OP_SUB: case OP_MUL: {
-        assert(gate->nargs == 2);
-        char *lhs = acirc_to_sage(c, gate->args[0]);
-        char *rhs = acirc_to_sage(c, gate->args[1]);
+        assert(gate.nargs == 2);
+        const char *lhs = strs[gate.args[0]];
+        const char *rhs = strs[gate.args[1]];
         size = strlen(lhs) + strlen(rhs) + strlen("()() _ ") + 1;
         str = calloc(size, sizeof str[0]);
-        char ch = gate->op == OP_ADD ? '+'
-            : gate->op == OP_SUB ? '-'
+        char ch = gate.op == OP_ADD ? '+'
+            : gate.op == OP_SUB ? '-'
             : '*';
         snprintf(str, size, "(%s) %c (%s)", lhs, ch, rhs);
-        free(lhs);
-        free(rhs);
         break;
     }
     default:
-        fprintf(stderr, "error: op '%s' not supported\n", acirc_op2str(gate->op));
+        fprintf(stderr, "error: op '%s' not supported\n", acirc_op2str(gate.op));
         abort();
     }
+    strs[ref] = str;
+}
+
+char *
+acirc_to_sage(const acirc *c, acircref ref)
+{
+    walk_t *w = walk_acquire(c);
+    char **strs = acirc_calloc(acirc_nrefs(c) + 1, sizeof strs[0]);
+    char *str;
+
+    walk_begin(w, c);
+    walk_from(w, c, ref, NULL, sage_fn, strs);
+    walk_release(c, w);
+    str = strs[ref];
+    strs[ref] = NULL;
+    for (size_t i = 0; i < acirc_nrefs(c); ++i)
+        free(strs[i]);
+    free(strs);
     return str;
 }
@@ -0,0 +1,272 @@
+#include "analysis.h"
+#include "plan.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static inline uint64_t fp_mix(uint64_t h, uint64_t w)
+{
+    h ^= w;
+    h *= 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+/* Everything the analyses read: the number of inputs, each ref's op and
+ * arguments, and the outputs.  Command payloads such as tests don't count. */
+uint64_t acirc_fingerprint(const acirc *c)
+{
+    const size_t nrefs = acirc_nrefs(c);
+    uint64_t h = fp_mix(0, nrefs);
+
+    h = fp_mix(h, c->ninputs);
+    for (size_t ref = 0; ref < nrefs; ++ref) {
+        const acircref *args = acirc_args(c, ref);
+        const size_t nargs = acirc_nargs(c, ref);
+        h = fp_mix(h, (uint64_t) acirc_op(c, ref) << 32 | nargs);
+        for (size_t i = 0; i < nargs; ++i)
+            h = fp_mix(h, (uint64_t) args[i]);
+    }
+    h = fp_mix(h, c->outputs.n);
+    for (size_t i = 0; i < c->outputs.n; ++i)
+        h = fp_mix(h, (uint64_t) c->outputs.buf[i]);
+    return h;
+}
+
+static size_t pad8(size_t n)
+{
+    return (n + 7) & ~(size_t) 7;
+}
+
+static int ana_write(const void *buf, size_t size, size_t n, FILE *fp)
+{
+    static const char zeros[8];
+    const size_t len = size * n;
+    if (len && fwrite(buf, 1, len, fp) != len)
+        return ACIRC_ERR;
+    if (pad8(len) != len && fwrite(zeros, 1, pad8(len) - len, fp) != pad8(len) - len)
+        return ACIRC_ERR;
+    return ACIRC_OK;
+}
+
+static int ana_read(void *buf, size_t size, size_t n, FILE *fp)
+{
+    char pad[8];
+    const size_t len = size * n;
+    if (len && fread(buf, 1, len, fp) != len)
+        return ACIRC_ERR;
+    if (pad8(len) != len && fread(pad, 1, pad8(len) - len, fp) != pad8(len) - len)
+        return ACIRC_ERR;
+    return ACIRC_OK;
+}
+
+int acirc_fwrite_analysis(const acirc *c, FILE *fp)
+{
+    const acirc_stats_t *st = acirc_stats(c);
+    const size_t *degrees = acirc_stats_degrees(c, NULL);
+    acirc_plan *p = acirc_plan_new(c);
+    uint64_t stats[5], *u64 = NULL;
+    ana_header_t h;
+    int ret = ACIRC_ERR;
+
+    plan_levels(p);
+    memset(&h, '\0', sizeof h);
+    memcpy(h.magic, ANA_MAGIC, sizeof h.magic);
+    h.version = ANA_VERSION;
+    h.bom = ANA_BOM;
+    h.refsize = sizeof(acircref);
+    h.fingerprint = acirc_fingerprint(c);
+    h.nrefs = acirc_nrefs(c);
+    h.ninputs = c->ninputs;
+    h.noutputs = c->outputs.n;
+    h.norder = p->n;
+    h.nlevels = p->nlevels;
+
+    stats[0] = st->depth;
+    stats[1] = st->degree;
+    stats[2] = st->total_degree;
+    stats[3] = st->nmuls;
+    stats[4] = acirc_delta(c);
+    u64 = acirc_calloc(c->ninputs + p->nlevels + p->n + 2, sizeof u64[0]);
+    if (ana_write(&h, sizeof h, 1, fp) == ACIRC_ERR
+        || ana_write(stats, sizeof stats[0], 5, fp) == ACIRC_ERR)
+        goto cleanup;
+    for (size_t i = 0; i < c->ninputs + 1; ++i)
+        u64[i] = degrees[i];
+    if (ana_write(u64, sizeof u64[0], c->ninputs + 1, fp) == ACIRC_ERR
+        || ana_write(p->refs, sizeof p->refs[0], p->n, fp) == ACIRC_ERR)
+        goto cleanup;
+    for (size_t i = 0; i < p->nlevels + 1; ++i)
+        u64[i] = p->level_offsets[i];
+    if (ana_write(u64, sizeof u64[0], p->nlevels + 1, fp) == ACIRC_ERR)
+        goto cleanup;
+    for (size_t i = 0; i < p->n; ++i)
+        u64[i] = p->level_steps[i];
+    if (ana_write(u64, sizeof u64[0], p->n, fp) == ACIRC_ERR)
+        goto cleanup;
+    ret = ACIRC_OK;
+cleanup:
+    if (ret == ACIRC_ERR)
+        fprintf(stderr, "error: unable to write analysis\n");
+    free(u64);
+    acirc_plan_free(p);
+    return ret;
+}
+
+/* reads n uint64_t into size_t */
+static int ana_read_sizes(size_t *out, size_t n, FILE *fp)
+{
+    uint64_t *u64 = acirc_calloc(n + 1, sizeof u64[0]);
+    int ret = ana_read(u64, sizeof u64[0], n, fp);
+    for (size_t i = 0; i < n; ++i)
+        out[i] = u64[i];
+    free(u64);
+    return ret;
+}
+
+/* A loaded order and schedule are used as they are, so damage that the
+ * fingerprint misses must not get through: the order must name each ref at
+ * most once, after everything it reads, and include every output, and the
+ * schedule must hold every step exactly once, in a level after the levels of
+ * the steps it reads. */
+static bool ana_check(const acirc *c, const acirc_stats_cache *s)
+{
+    const size_t nrefs = acirc_nrefs(c);
+    size_t *step = acirc_calloc(nrefs + 1, sizeof step[0]);
+    size_t *level = acirc_calloc(s->norder + 1, sizeof level[0]);
+    bool ok = false;
+
+    if (s->level_offsets[0] != 0 || s->level_offsets[s->nlevels] != s->norder)
+        goto cleanup;
+    for (size_t k = 0; k < s->nlevels; ++k)
+        if (s->level_offsets[k] > s->level_offsets[k + 1])
+            goto cleanup;
+
+    for (size_t ref = 0; ref < nrefs; ++ref)
+        step[ref] = SIZE_MAX;
+    for (size_t i = 0; i < s->norder; ++i) {
+        const acircref ref = s->order[i];
+        if (ref < 0 || (size_t) ref >= nrefs || step[ref] != SIZE_MAX)
+            goto cleanup;
+        step[ref] = i;
+        level[i] = SIZE_MAX;
+    }
+    for (size_t k = 0; k < s->nlevels; ++k) {
+        for (size_t j = s->level_offsets[k]; j < s->level_offsets[k + 1]; ++j) {
+            const size_t i = s->level_steps[j];
+            if (i >= s->norder || level[i] != SIZE_MAX)
+                goto cleanup;
+            level[i] = k;
+        }
+    }
+    for (size_t i = 0; i < s->norder; ++i) {
+        const acircref ref = s->order[i];
+        const acircref *args = acirc_args(c, ref);
+        switch (acirc_op(c, ref)) {
+        case OP_INPUT: case OP_CONST:
+            break;
+        default:
+            for (size_t j = 0; j < acirc_nargs(c, ref); ++j) {
+                if (args[j] < 0 || (size_t) args[j] >= nrefs || step[args[j]] >= i
+                    || level[step[args[j]]] >= level[i])
+                    goto cleanup;
+            }
+            break;
+        }
+    }
+    for (size_t i = 0; i < c->outputs.n; ++i) {
+        const acircref out = c->outputs.buf[i];
+        if (out < 0 || (size_t) out >= nrefs || step[out] == SIZE_MAX)
+            goto cleanup;
+    }
+    ok = true;
+cleanup:
+    free(step);
+    free(level);
+    return ok;
+}
+
+int acirc_fread_analysis(acirc *c, FILE *fp)
+{
+    acirc_stats_cache *s = c->stats;
+    ana_header_t h;
+    uint64_t stats[5];
+
+    if (ana_read(&h, sizeof h, 1, fp) == ACIRC_ERR
+        || memcmp(h.magic, ANA_MAGIC, sizeof h.magic) != 0
+        || h.version != ANA_VERSION || h.bom != ANA_BOM
+        || h.refsize != sizeof(acircref)
+        || h.nrefs != acirc_nrefs(c) || h.ninputs != c->ninputs
+        || h.noutputs != c->outputs.n || h.norder > h.nrefs
+        || h.nlevels > h.norder
+        || h.fingerprint != acirc_fingerprint(c))
+        return ACIRC_ERR;
+
+    acirc_invalidate_stats(c);
+    free(s->degrees);
+    s->degrees = acirc_calloc(c->ninputs + 1, sizeof s->degrees[0]);
+    s->norder = h.norder;
+    s->nlevels = h.nlevels;
+    s->order = acirc_calloc(h.norder + 1, sizeof s->order[0]);
+    s->level_offsets = acirc_calloc(h.nlevels + 1, sizeof s->level_offsets[0]);
+    s->level_steps = acirc_calloc(h.norder + 1, sizeof s->level_steps[0]);
+    if (ana_read(stats, sizeof stats[0], 5, fp) == ACIRC_ERR
+        || ana_read_sizes(s->degrees, c->ninputs + 1, fp) == ACIRC_ERR
+        || ana_read(s->order, sizeof s->order[0], h.norder, fp) == ACIRC_ERR
+        || ana_read_sizes(s->level_offsets, h.nlevels + 1, fp) == ACIRC_ERR
+        || ana_read_sizes(s->level_steps, h.norder, fp) == ACIRC_ERR
+        || !ana_check(c, s)) {
+        acirc_invalidate_stats(c);
+        return ACIRC_ERR;
+    }
+    s->stats.depth = stats[0];
+    s->stats.degree = stats[1];
+    s->stats.total_degree = stats[2];
+    s->stats.nmuls = stats[3];
+    s->delta = stats[4];
+    atomic_store(&s->valid, true);
+    atomic_store(&s->degrees_valid, true);
+    return ACIRC_OK;
+}
+
+int acirc_analysis_sidecar(acirc *c, const char *path)
+{
+    const size_t len = strlen(path);
+    char *name = acirc_calloc(len + sizeof ANA_SUFFIX, sizeof name[0]);
+    char *tmp = acirc_calloc(len + sizeof ANA_SUFFIX + 32, sizeof tmp[0]);
+    FILE *fp;
+    int ret = ACIRC_ERR;
+
+    memcpy(name, path, len);
+    memcpy(name + len, ANA_SUFFIX, sizeof ANA_SUFFIX);
+    if ((fp = fopen(name, "rb")) != NULL) {
+        ret = acirc_fread_analysis(c, fp);
+        fclose(fp);
+        if (ret == ACIRC_OK)
+            goto cleanup;
+    }
+
+    /* written under a private name and renamed into place, so that workers
+     * starting together never read a partial file */
+    snprintf(tmp, len + sizeof ANA_SUFFIX + 32, "%s.%ld", name, (long) getpid());
+    if ((fp = fopen(tmp, "wb")) == NULL) {
+        fprintf(stderr, "error: unable to open '%s' for writing\n", tmp);
+        goto cleanup;
+    }
+    ret = acirc_fwrite_analysis(c, fp);
+    if (fclose(fp) != 0)
+        ret = ACIRC_ERR;
+    if (ret == ACIRC_OK && rename(tmp, name) != 0) {
+        fprintf(stderr, "error: unable to rename '%s' to '%s'\n", tmp, name);
+        ret = ACIRC_ERR;
+    }
+    if (ret == ACIRC_ERR)
+        (void) remove(tmp);
+cleanup:
+    free(name);
+    free(tmp);
+    return ret;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Analysis sidecar format.  Like the binary circuit format, integers are in
+ * host byte order and the header records enough to reject foreign files:
+ *
+ *   header
+ *   stats          uint64_t[5]            depth, degree, total degree and
+ *                                         nmuls, as in acirc_stats_t, and
+ *                                         acirc_delta
+ *   degrees        uint64_t[ninputs + 1]  acirc_stats_degrees
+ *   order          acircref[norder]       topological order of the outputs
+ *   level_offsets  uint64_t[nlevels + 1]  level schedule of that order, as
+ *   level_steps    uint64_t[norder]       in acirc_plan
+ *
+ * Each section starts on an 8-byte boundary.  The header carries the
+ * fingerprint of the circuit it was computed for, so a file left behind by
+ * an older version of the circuit is rejected rather than trusted. */
+
+#define ANA_MAGIC "ACIRCANA"
+#define ANA_VERSION 1
+#define ANA_BOM 0x01020304u
+#define ANA_SUFFIX ".analysis"
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t bom;
+    uint32_t refsize;
+    uint32_t _pad;
+    uint64_t fingerprint;
+    uint64_t nrefs;
+    uint64_t ninputs;
+    uint64_t noutputs;
+    uint64_t norder;
+    uint64_t nlevels;
+} ana_header_t;
@@ -0,0 +1,89 @@
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Bump allocator.  Memory is carved out of a list of chunks and released all
+ * at once, so objects allocated here are never freed individually. */
+
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK_MIN (1 << 16)
+#define ARENA_CHUNK_MAX (1 << 20)
+
+struct acirc_arena_chunk {
+    struct acirc_arena_chunk *next;
+    size_t size;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+void acirc_arena_init(acirc_arena_t *a)
+{
+    a->chunks = NULL;
+    a->ptr = NULL;
+    a->left = 0;
+}
+
+void acirc_arena_clear(acirc_arena_t *a)
+{
+    acirc_arena_chunk *chunk = a->chunks;
+    while (chunk) {
+        acirc_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    acirc_arena_init(a);
+}
+
+/* frees all but the most recent chunk, which is kept for reuse */
+void acirc_arena_reset(acirc_arena_t *a)
+{
+    acirc_arena_chunk *head = a->chunks;
+    if (head == NULL)
+        return;
+    a->chunks = head->next;
+    acirc_arena_clear(a);
+    head->next = NULL;
+    a->chunks = head;
+    a->ptr = head->data;
+    a->left = head->size;
+}
+
+void * acirc_arena_alloc(acirc_arena_t *a, size_t size)
+{
+    void *ptr;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (size == 0)
+        size = ARENA_ALIGN;
+    if (size > a->left) {
+        acirc_arena_chunk *chunk;
+        size_t csize = a->chunks ? a->chunks->size * 2 : ARENA_CHUNK_MIN;
+        if (csize > ARENA_CHUNK_MAX)
+            csize = ARENA_CHUNK_MAX;
+        if (csize < size)
+            csize = size;
+        chunk = acirc_malloc(sizeof chunk[0] + csize);
+        chunk->size = csize;
+        chunk->next = a->chunks;
+        a->chunks = chunk;
+        a->ptr = chunk->data;
+        a->left = csize;
+    }
+    ptr = a->ptr;
+    a->ptr += size;
+    a->left -= size;
+    return ptr;
+}
+
+void * acirc_arena_calloc(acirc_arena_t *a, size_t nmemb, size_t size)
+{
+    void *ptr = acirc_arena_alloc(a, nmemb * size);
+    memset(ptr, '\0', nmemb * size);
+    return ptr;
+}
+
+char * acirc_arena_strdup(acirc_arena_t *a, const char *s)
+{
+    const size_t len = strlen(s) + 1;
+    return memcpy(acirc_arena_alloc(a, len), s, len);
+}
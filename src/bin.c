@@ -0,0 +1,354 @@
+#include "acirc.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Binary circuit format.  All integers are in host byte order, which the
+ * header records so that foreign files are rejected rather than misread.
+ *
+ *   header
+ *   ops      uint8_t[nrefs]         gate operation, indexed by ref
+ *   nargs    uint32_t[nrefs]        argument count, indexed by ref
+ *   offsets  uint64_t[nrefs]        start of each ref's arguments in args
+ *   args     acircref[nargs_total]  flat argument array
+ *   outputs  acircref[noutputs]
+ *   secrets  acircref[nsecrets]
+ *   consts   int32_t[nconsts]
+ *   tests    int32_t[ntests][ninputs], then int32_t[ntests][noutputs]
+ *
+ * Every section starts on an 8-byte boundary and the gate sections have the
+ * same layout as acirc_gates_t, so acirc_fread_bin can use a read-only mapping
+ * of the file in place as the circuit's gate storage. */
+
+#define BIN_MAGIC "ACIRCBIN"
+#define BIN_VERSION 1
+#define BIN_BOM 0x01020304u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t bom;
+    uint32_t refsize;
+    uint32_t _pad;
+    uint64_t nrefs;
+    uint64_t ninputs;
+    uint64_t nargs;
+    uint64_t noutputs;
+    uint64_t nsecrets;
+    uint64_t nconsts;
+    uint64_t ntests;
+} bin_header_t;
+
+static size_t pad8(size_t n)
+{
+    return (n + 7) & ~(size_t) 7;
+}
+
+static int bin_write(const void *buf, size_t size, size_t n, FILE *fp)
+{
+    static const char zeros[8];
+    const size_t len = size * n;
+    if (len && fwrite(buf, 1, len, fp) != len)
+        return ACIRC_ERR;
+    if (pad8(len) != len && fwrite(zeros, 1, pad8(len) - len, fp) != pad8(len) - len)
+        return ACIRC_ERR;
+    return ACIRC_OK;
+}
+
+int acirc_fwrite_bin(const acirc *c, FILE *fp)
+{
+    const size_t nrefs = acirc_nrefs(c);
+    bin_header_t h;
+    uint8_t *ops = NULL;
+    uint32_t *nargs = NULL;
+    uint64_t *offsets = NULL;
+    acircref *args = NULL;
+    int32_t *ints = NULL;
+    size_t total = 0;
+    int ret = ACIRC_ERR;
+
+    for (size_t i = 0; i < nrefs; ++i) {
+        if (acirc_op(c, i) == OP_EXTERNAL) {
+            fprintf(stderr, "error: external gates cannot be written\n");
+            return ACIRC_ERR;
+        }
+        total += acirc_nargs(c, i);
+    }
+
+    memset(&h, '\0', sizeof h);
+    memcpy(h.magic, BIN_MAGIC, sizeof h.magic);
+    h.version = BIN_VERSION;
+    h.bom = BIN_BOM;
+    h.refsize = sizeof(acircref);
+    h.nrefs = nrefs;
+    h.ninputs = c->ninputs;
+    h.nargs = total;
+    h.noutputs = c->outputs.n;
+    h.nsecrets = c->secrets.n;
+    h.nconsts = c->consts.n;
+    h.ntests = c->tests.n;
+
+    ops = acirc_calloc(nrefs + 1, sizeof ops[0]);
+    nargs = acirc_calloc(nrefs + 1, sizeof nargs[0]);
+    offsets = acirc_calloc(nrefs + 1, sizeof offsets[0]);
+    args = acirc_calloc(total + 1, sizeof args[0]);
+    total = 0;
+    for (size_t i = 0; i < nrefs; ++i) {
+        ops[i] = acirc_op(c, i);
+        nargs[i] = acirc_nargs(c, i);
+        offsets[i] = total;
+        memcpy(&args[total], acirc_args(c, i), nargs[i] * sizeof args[0]);
+        total += nargs[i];
+    }
+
+    if (bin_write(&h, sizeof h, 1, fp) == ACIRC_ERR
+        || bin_write(ops, sizeof ops[0], nrefs, fp) == ACIRC_ERR
+        || bin_write(nargs, sizeof nargs[0], nrefs, fp) == ACIRC_ERR
+        || bin_write(offsets, sizeof offsets[0], nrefs, fp) == ACIRC_ERR
+        || bin_write(args, sizeof args[0], total, fp) == ACIRC_ERR
+        || bin_write(c->outputs.buf, sizeof(acircref), c->outputs.n, fp) == ACIRC_ERR
+        || bin_write(c->secrets.list, sizeof(acircref), c->secrets.n, fp) == ACIRC_ERR)
+        goto cleanup;
+
+    ints = acirc_calloc(c->consts.n + 1, sizeof ints[0]);
+    for (size_t i = 0; i < c->consts.n; ++i)
+        ints[i] = c->consts.buf[i];
+    if (bin_write(ints, sizeof ints[0], c->consts.n, fp) == ACIRC_ERR)
+        goto cleanup;
+    free(ints);
+
+    ints = acirc_calloc(c->tests.n * (c->ninputs + c->outputs.n) + 1, sizeof ints[0]);
+    for (size_t t = 0; t < c->tests.n; ++t) {
+        for (size_t i = 0; i < c->ninputs; ++i)
+            ints[t * c->ninputs + i] = c->tests.inps[t][i];
+        for (size_t i = 0; i < c->outputs.n; ++i)
+            ints[c->tests.n * c->ninputs + t * c->outputs.n + i] = c->tests.outs[t][i];
+    }
+    if (bin_write(ints, sizeof ints[0], c->tests.n * (c->ninputs + c->outputs.n), fp) == ACIRC_ERR)
+        goto cleanup;
+
+    ret = ACIRC_OK;
+cleanup:
+    if (ret == ACIRC_ERR)
+        fprintf(stderr, "error: unable to write binary circuit\n");
+    free(ops);
+    free(nargs);
+    free(offsets);
+    free(args);
+    free(ints);
+    return ret;
+}
+
+/* Returns a pointer to the next section of 'n' elements of 'size' bytes,
+ * or NULL if it runs past the end of the buffer. */
+static void * bin_section(char *buf, size_t len, size_t *pos, size_t size,
+                          uint64_t n)
+{
+    void *p = buf + *pos;
+    if (size && n > (len - *pos) / size)
+        return NULL;
+    *pos += pad8(size * n);
+    if (*pos > len)
+        *pos = len;
+    return p;
+}
+
+/* Points the gate arrays of the (empty) circuit c straight into the mapping,
+ * which c then owns. */
+static void bin_borrow(acirc *c, const bin_header_t *h, void *map, size_t len,
+                       uint8_t *ops, uint32_t *nargs, uint64_t *offsets,
+                       acircref *args)
+{
+    acirc_gates_t *g = &c->gates;
+    acirc_invalidate(c);
+    free(g->ops);
+    free(g->nargs);
+    free(g->offsets);
+    free(g->args);
+    g->ops = ops;
+    g->nargs = nargs;
+    g->offsets = (size_t *) offsets;
+    g->args = args;
+    g->_alloc = h->nrefs;
+    g->_args_n = g->_args_alloc = h->nargs;
+    g->n = h->nrefs - h->ninputs - h->nconsts;
+    g->_map = map;
+    g->_map_len = len;
+    c->ninputs = h->ninputs;
+}
+
+static void bin_copy(acirc *c, const bin_header_t *h, const uint8_t *ops,
+                     const uint32_t *nargs, const uint64_t *offsets,
+                     const acircref *args)
+{
+    for (size_t i = 0; i < h->nrefs; ++i) {
+        const acircref *a = &args[offsets[i]];
+        switch (ops[i]) {
+        case OP_INPUT:
+            acirc_add_input(c, i, a[0]);
+            break;
+        case OP_CONST:
+            acirc_add_const(c, i, a[1]);
+            break;
+        default:
+            acirc_add_gate(c, i, ops[i], a, nargs[i]);
+            break;
+        }
+    }
+}
+
+/* Returns 1 if c took ownership of the mapping */
+static int bin_read(acirc *c, char *buf, size_t len)
+{
+    const bin_header_t *h = (const bin_header_t *) buf;
+    uint8_t *ops;
+    uint32_t *nargs;
+    uint64_t *offsets;
+    acircref *args, *outputs, *secrets;
+    int32_t *consts, *inps, *outs;
+    size_t pos = sizeof h[0];
+    size_t ninputs = 0, nconsts = 0;
+    uint64_t ntest_inps, ntest_outs;
+    bool borrow;
+
+    if (len < sizeof h[0] || memcmp(h->magic, BIN_MAGIC, sizeof h->magic) != 0) {
+        fprintf(stderr, "error: not a binary acirc file\n");
+        return ACIRC_ERR;
+    }
+    if (h->bom != BIN_BOM || h->version != BIN_VERSION || h->refsize != sizeof(acircref)) {
+        fprintf(stderr, "error: unsupported binary acirc file (version %u)\n", h->version);
+        return ACIRC_ERR;
+    }
+    /* a wrapped product would pass the section bounds checks below */
+    if (__builtin_mul_overflow(h->ntests, h->ninputs, &ntest_inps)
+        || __builtin_mul_overflow(h->ntests, h->noutputs, &ntest_outs))
+        goto corrupt;
+    ops = bin_section(buf, len, &pos, sizeof ops[0], h->nrefs);
+    nargs = bin_section(buf, len, &pos, sizeof nargs[0], h->nrefs);
+    offsets = bin_section(buf, len, &pos, sizeof offsets[0], h->nrefs);
+    args = bin_section(buf, len, &pos, sizeof args[0], h->nargs);
+    outputs = bin_section(buf, len, &pos, sizeof outputs[0], h->noutputs);
+    secrets = bin_section(buf, len, &pos, sizeof secrets[0], h->nsecrets);
+    consts = bin_section(buf, len, &pos, sizeof consts[0], h->nconsts);
+    inps = bin_section(buf, len, &pos, sizeof inps[0], ntest_inps);
+    outs = bin_section(buf, len, &pos, sizeof outs[0], ntest_outs);
+    if (!ops || !nargs || !offsets || !args || !outputs || !secrets || !consts
+        || !inps || !outs)
+        goto corrupt;
+
+    for (size_t i = 0; i < h->nrefs; ++i) {
+        if (offsets[i] > h->nargs || nargs[i] > h->nargs - offsets[i])
+            goto corrupt;
+        switch (ops[i]) {
+        case OP_INPUT:
+            if (nargs[i] != 1 || (uint64_t) args[offsets[i]] >= h->ninputs)
+                goto corrupt;
+            ninputs++;
+            break;
+        case OP_CONST:
+            if (nargs[i] != 2 || (uint64_t) args[offsets[i]] >= h->nconsts)
+                goto corrupt;
+            nconsts++;
+            break;
+        case OP_SET:
+            if (nargs[i] == 0)
+                goto corrupt;
+            /* fallthrough */
+        case OP_ADD: case OP_SUB: case OP_MUL:
+            /* evaluation indexes by argument, so every one must be a ref */
+            for (size_t j = 0; j < nargs[i]; ++j)
+                if ((uint64_t) args[offsets[i] + j] >= h->nrefs)
+                    goto corrupt;
+            break;
+        default:
+            goto corrupt;
+        }
+    }
+    if (ninputs != h->ninputs || nconsts != h->nconsts)
+        goto corrupt;
+    for (size_t i = 0; i < h->noutputs; ++i)
+        if ((uint64_t) outputs[i] >= h->nrefs)
+            goto corrupt;
+    for (size_t i = 0; i < h->nsecrets; ++i)
+        if ((uint64_t) secrets[i] >= h->nrefs)
+            goto corrupt;
+
+    borrow = acirc_nrefs(c) == 0 && c->gates._ext_n == 0
+        && sizeof(size_t) == sizeof(uint64_t);
+    if (borrow)
+        bin_borrow(c, h, buf, len, ops, nargs, offsets, args);
+    else
+        bin_copy(c, h, ops, nargs, offsets, args);
+
+    if (borrow) {
+        acirc_consts_t *k = &c->consts;
+        if (h->nconsts > k->_alloc) {
+            k->_alloc = h->nconsts;
+            k->buf = acirc_realloc(k->buf, k->_alloc * sizeof k->buf[0]);
+        }
+        for (size_t i = 0; i < h->nconsts; ++i)
+            k->buf[i] = consts[i];
+        k->n = h->nconsts;
+    }
+    for (size_t i = 0; i < h->noutputs; ++i)
+        acirc_add_output(c, outputs[i]);
+
+    c->secrets.n = h->nsecrets;
+    c->secrets.list = acirc_arena_calloc(&c->arena, h->nsecrets, sizeof c->secrets.list[0]);
+    memcpy(c->secrets.list, secrets, h->nsecrets * sizeof secrets[0]);
+
+    c->tests.n = h->ntests;
+    c->tests.inps = acirc_calloc(h->ntests, sizeof c->tests.inps[0]);
+    c->tests.outs = acirc_calloc(h->ntests, sizeof c->tests.outs[0]);
+    for (size_t t = 0; t < h->ntests; ++t) {
+        c->tests.inps[t] = acirc_arena_calloc(&c->arena, h->ninputs, sizeof c->tests.inps[t][0]);
+        c->tests.outs[t] = acirc_arena_calloc(&c->arena, h->noutputs, sizeof c->tests.outs[t][0]);
+        for (size_t i = 0; i < h->ninputs; ++i)
+            c->tests.inps[t][i] = inps[t * h->ninputs + i];
+        for (size_t i = 0; i < h->noutputs; ++i)
+            c->tests.outs[t][i] = outs[t * h->noutputs + i];
+    }
+    return borrow ? 1 : ACIRC_OK;
+
+corrupt:
+    fprintf(stderr, "error: corrupt binary acirc file\n");
+    return ACIRC_ERR;
+}
+
+acirc * acirc_fread_bin(acirc *c, FILE *fp)
+{
+    bool mine = false;
+    struct stat st;
+    char *map;
+    int ret;
+
+    if (fstat(fileno(fp), &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        fprintf(stderr, "error: binary circuits must be read from a regular file\n");
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "error: unable to map binary circuit\n");
+        return NULL;
+    }
+    if (c == NULL) {
+        c = acirc_calloc(1, sizeof c[0]);
+        acirc_init(c);
+        mine = true;
+    }
+    ret = bin_read(c, map, st.st_size);
+    if (ret != 1)
+        munmap(map, st.st_size);
+    if (ret == ACIRC_ERR) {
+        if (mine) {
+            acirc_clear(c);
+            free(c);
+        }
+        return NULL;
+    }
+    return c;
+}
@@ -1,18 +1,24 @@
 #include "acirc.h"
+#include "cse.h"
 #include "utils.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void
-acirc_init_gate(acirc_gate_t *gate, acirc_operation op, acircref *args, size_t nargs)
+/* points ref at 'nargs' fresh slots of the flat argument array */
+static acircref *
+acirc_init_gate(acirc *c, acircref ref, acirc_operation op, size_t nargs)
 {
-    gate->op = op;
-    gate->args = args;
-    gate->nargs = nargs;
-    gate->name = NULL;
-    gate->external = NULL;
+    acirc_gates_t *g = &c->gates;
+    size_t off;
+    acirc_invalidate(c);
+    ensure_gate_space(c, ref);
+    off = ensure_args_space(c, nargs);
+    g->ops[ref] = op;
+    g->nargs[ref] = nargs;
+    g->offsets[ref] = off;
+    return &g->args[off];
 }
 
 int acirc_add_command(acirc *c, const char *name, const char **strs, size_t n)
@@ -28,11 +34,10 @@ int acirc_add_command(acirc *c, const char *name, const char **strs, size_t n)
 
 int acirc_add_input(acirc *c, acircref ref, acircref id)
 {
-    ensure_gate_space(c, ref);
-    acircref *args = acirc_calloc(1, sizeof args[0]);
+    if (ref < 0)
+        return ACIRC_ERR;
+    acircref *args = acirc_init_gate(c, ref, OP_INPUT, 1);
     args[0] = id;
-    acirc_gate_t *gate = &c->gates.gates[ref];
-    acirc_init_gate(gate, OP_INPUT, args, 1);
     c->ninputs++;
     return ACIRC_OK;
 }
@@ -40,34 +45,169 @@ int acirc_add_input(acirc *c, acircref ref, acircref id)
 int acirc_add_const(acirc *c, acircref ref, int val)
 {
     acirc_consts_t *consts = &c->consts;
+    if (ref < 0 || consts->n >= (size_t) ACIRC_REF_MAX)
+        return ACIRC_ERR;
     if (consts->n >= consts->_alloc) {
         consts->_alloc *= 2;
         consts->buf = acirc_realloc(consts->buf, consts->_alloc * sizeof consts->buf[0]);
     }
     consts->buf[consts->n] = val;
 
-    ensure_gate_space(c, ref);
-    acircref *args = acirc_calloc(2, sizeof args[0]);
+    acircref *args = acirc_init_gate(c, ref, OP_CONST, 2);
     args[0] = consts->n;
     args[1] = val;
-    acirc_gate_t *gate = &c->gates.gates[ref];
-    acirc_init_gate(gate, OP_CONST, args, 2);
     consts->n++;
     return ACIRC_OK;
 }
 
-int acirc_add_gate(acirc *c, acircref ref, acirc_operation op,
-                   const acircref *refs, size_t n)
+static int add_gate(acirc *c, acircref ref, acirc_operation op,
+                    const acircref *refs, size_t n)
 {
-    ensure_gate_space(c, ref);
-    acircref *args = acirc_calloc(n, sizeof args[0]);
+    const acirc_gates_t *g = &c->gates;
+    size_t alias = SIZE_MAX;
+    /* refs may point into our own argument array, which can move */
+    if (refs >= g->args && refs < g->args + g->_args_n)
+        alias = refs - g->args;
+    acircref *args = acirc_init_gate(c, ref, op, n);
+    if (alias != SIZE_MAX)
+        refs = &g->args[alias];
     memcpy(args, refs, n * sizeof args[0]);
-    acirc_gate_t *gate = &c->gates.gates[ref];
-    acirc_init_gate(gate, op, args, n);
     c->gates.n++;
     return ACIRC_OK;
 }
 
+/* a gate equal to an earlier one becomes a SET of it */
+static int hashcons_add_gate(acirc *c, acircref ref, acirc_operation op,
+                             const acircref *refs, size_t n)
+{
+    cse_t *t = c->hashcons;
+    acircref prev;
+
+    if (op == OP_SET) {
+        if (n > 0)
+            cse_alias(t, ref, cse_resolve(t, refs[0]));
+        return add_gate(c, ref, op, refs, n);
+    }
+    prev = cse_intern(t, op, refs, n, ref);
+    if (prev == ref)
+        return add_gate(c, ref, op, t->key, t->nkey);
+    cse_alias(t, ref, prev);
+    return add_gate(c, ref, OP_SET, &prev, 1);
+}
+
+int acirc_add_gate(acirc *c, acircref ref, acirc_operation op,
+                   const acircref *refs, size_t n)
+{
+    if (ref < 0 || n > UINT32_MAX)
+        return ACIRC_ERR;
+    if (c->hashcons && (op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_SET))
+        return hashcons_add_gate(c, ref, op, refs, n);
+    return add_gate(c, ref, op, refs, n);
+}
+
+acircref acirc_intern_gate(acirc *c, acirc_operation op, const acircref *refs,
+                           size_t n)
+{
+    const acircref ref = acirc_nrefs(c);
+    cse_t *t = c->hashcons;
+
+    if (t && op == OP_SET && n > 0)
+        return cse_resolve(t, refs[0]);
+    if (t && (op == OP_ADD || op == OP_SUB || op == OP_MUL) && n <= UINT32_MAX) {
+        const acircref prev = cse_intern(t, op, refs, n, ref);
+        if (prev != ref)
+            return prev;
+        return add_gate(c, ref, op, t->key, t->nkey) == ACIRC_OK ? ref : -1;
+    }
+    return acirc_add_gate(c, ref, op, refs, n) == ACIRC_OK ? ref : -1;
+}
+
+void acirc_hashcons(acirc *c, bool on)
+{
+    if (!on) {
+        cse_free(c->hashcons);
+        c->hashcons = NULL;
+        return;
+    }
+    if (c->hashcons)
+        return;
+    c->hashcons = cse_new();
+    for (size_t ref = 0; ref < acirc_nrefs(c); ++ref) {
+        const acirc_operation op = acirc_op(c, ref);
+        const acircref *args = acirc_args(c, ref);
+        const size_t nargs = acirc_nargs(c, ref);
+        acircref prev;
+        switch (op) {
+        case OP_SET:
+            if (nargs > 0)
+                cse_alias(c->hashcons, ref, cse_resolve(c->hashcons, args[0]));
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL:
+            prev = cse_intern(c->hashcons, op, args, nargs, ref);
+            if ((size_t) prev != ref)
+                cse_alias(c->hashcons, ref, prev);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+int acirc_reserve(acirc *c, size_t ngates, size_t nargs_total)
+{
+    reserve_space(c, ngates, nargs_total);
+    return ACIRC_OK;
+}
+
+int acirc_add_gates(acirc *c, acircref first_ref, const acirc_operation *ops,
+                    const size_t *offsets, const acircref *args, size_t n)
+{
+    acirc_gates_t *g = &c->gates;
+    size_t alias = SIZE_MAX, off;
+
+    if (n == 0)
+        return ACIRC_OK;
+    if (first_ref < 0 || n - 1 > (size_t) (ACIRC_REF_MAX - first_ref))
+        return ACIRC_ERR;
+    for (size_t i = 0; i < n; ++i) {
+        switch (ops[i]) {
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_SET:
+            break;
+        default:
+            return ACIRC_ERR;
+        }
+        if (offsets[i + 1] < offsets[i] || offsets[i + 1] - offsets[i] > UINT32_MAX)
+            return ACIRC_ERR;
+    }
+    /* args may point into our own argument array, which can move */
+    if (args >= g->args && args < g->args + g->_args_n)
+        alias = args - g->args;
+    if (c->hashcons) {
+        for (size_t i = 0; i < n; ++i) {
+            if (alias != SIZE_MAX)
+                args = &g->args[alias];
+            if (hashcons_add_gate(c, first_ref + i, ops[i], &args[offsets[i]],
+                                  offsets[i + 1] - offsets[i]) != ACIRC_OK)
+                return ACIRC_ERR;
+        }
+        return ACIRC_OK;
+    }
+    ensure_gate_space(c, first_ref + n - 1);
+    off = ensure_args_space(c, offsets[n] - offsets[0]);
+    if (alias != SIZE_MAX)
+        args = &g->args[alias];
+    acirc_invalidate(c);
+    memcpy(&g->args[off], &args[offsets[0]], (offsets[n] - offsets[0]) * sizeof args[0]);
+    for (size_t i = 0; i < n; ++i) {
+        const acircref ref = first_ref + i;
+        g->ops[ref] = ops[i];
+        g->nargs[ref] = offsets[i + 1] - offsets[i];
+        g->offsets[ref] = off + offsets[i] - offsets[0];
+    }
+    g->n += n;
+    return ACIRC_OK;
+}
+
 static void * _acirc_add_extgate(acirc_extgates_t *g, acircref ref,
                                  const char *name, const acircref *refs,
                                  size_t n)
@@ -83,17 +223,21 @@ static void * _acirc_add_extgate(acirc_extgates_t *g, acircref ref,
 int acirc_add_extgate(acirc *c, acircref ref, const char *name,
                       const acircref *refs, size_t n)
 {
-    ensure_gate_space(c, ref);
-    acircref *args = acirc_calloc(n, sizeof args[0]);
-    memcpy(args, refs, n * sizeof args[0]);
-    acirc_gate_t *gate = &c->gates.gates[ref];
-    acirc_init_gate(gate, OP_EXTERNAL, args, n);
-    gate->name = strdup(name);
-    gate->external = _acirc_add_extgate(&c->extgates, ref, name, refs, n);
-    if (gate->external == NULL) {
-        free(gate->args);
+    acirc_gates_t *g = &c->gates;
+    void *external;
+    if (ref < 0 || n > UINT32_MAX || g->_ext_n >= (size_t) ACIRC_REF_MAX)
         return ACIRC_ERR;
-    }
+    external = _acirc_add_extgate(&c->extgates, ref, name, refs, n);
+    if (external == NULL)
+        return ACIRC_ERR;
+    g->ext = acirc_realloc(g->ext, (g->_ext_n + 1) * sizeof g->ext[0]);
+    g->ext[g->_ext_n].name = acirc_arena_strdup(&c->arena, name);
+    g->ext[g->_ext_n].external = external;
+    /* the hidden last argument indexes the side table */
+    acircref *args = acirc_init_gate(c, ref, OP_EXTERNAL, n + 1);
+    memcpy(args, refs, n * sizeof args[0]);
+    args[n] = g->_ext_n++;
+    g->nargs[ref] = n;
     c->gates.n++;
     return ACIRC_OK;
 }
@@ -102,6 +246,7 @@ int acirc_add_output(acirc *c, acircref ref)
 {
     acirc_outputs_t *outputs = &c->outputs;
     const size_t last = outputs->n;
+    acirc_invalidate_stats(c);
     outputs->n++;
     outputs->buf = acirc_realloc(outputs->buf, outputs->n * sizeof outputs->buf[0]);
     outputs->buf[last] = ref;
@@ -0,0 +1,451 @@
+#include "acirc.h"
+#include "lines.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Parallel loader.  The file is split at newline boundaries and each chunk
+ * is tokenized on its own thread into a list of records.  One sequential
+ * pass over the records then checks them as the builder functions would,
+ * numbers the consts and runs the commands, all in file order, and sums the
+ * arguments each chunk adds.  With the gate arrays reserved once, every
+ * chunk then writes its gates straight into them in parallel, its arguments
+ * starting at the prefix sum of the chunks before it, so the result is laid
+ * out exactly as by a sequential parse. */
+
+/* below this many bytes per thread, automatic thread counts stop growing */
+#define CHUNK_MIN (1 << 20)
+
+enum { REC_INPUT, REC_CONST, REC_GATE, REC_COMMAND };
+
+typedef struct {
+    uint8_t kind;
+    uint8_t op;
+    uint32_t n;                 /* number of args, or of command strings */
+    acircref ref;
+    long val;                   /* input id or const value */
+    size_t off;                 /* start in args or in strs, or const index */
+} rec_t;
+
+typedef struct {
+    const char *buf;
+    size_t len;
+    rec_t *recs;
+    size_t nrecs, _recs_alloc;
+    acircref *args;
+    size_t nargs, _args_alloc;
+    char *strs;
+    size_t nstrs, _strs_alloc;
+    lines_t lines;
+    int ret;
+    acirc *c;
+    size_t args_off;            /* where the chunk's arguments go in c */
+    acircref minref, maxref;
+} chunk_t;
+
+static rec_t * chunk_rec(chunk_t *ch, uint8_t kind, acircref ref)
+{
+    rec_t *rec;
+    if (ch->nrecs == ch->_recs_alloc) {
+        ch->_recs_alloc *= 2;
+        ch->recs = acirc_realloc(ch->recs, ch->_recs_alloc * sizeof ch->recs[0]);
+    }
+    rec = &ch->recs[ch->nrecs++];
+    rec->kind = kind;
+    rec->ref = ref;
+    return rec;
+}
+
+static void chunk_strcat(chunk_t *ch, const char *s)
+{
+    const size_t len = strlen(s) + 1;
+    while (ch->nstrs + len > ch->_strs_alloc) {
+        ch->_strs_alloc *= 2;
+        ch->strs = acirc_realloc(ch->strs, ch->_strs_alloc * sizeof ch->strs[0]);
+    }
+    memcpy(&ch->strs[ch->nstrs], s, len);
+    ch->nstrs += len;
+}
+
+static int chunk_input(void *data, acircref ref, acircref id)
+{
+    chunk_rec(data, REC_INPUT, ref)->val = id;
+    return ACIRC_OK;
+}
+
+static int chunk_const(void *data, acircref ref, int val)
+{
+    chunk_rec(data, REC_CONST, ref)->val = val;
+    return ACIRC_OK;
+}
+
+static int chunk_gate(void *data, acircref ref, acirc_operation op,
+                      const acircref *args, size_t nargs)
+{
+    chunk_t *ch = data;
+    rec_t *rec;
+    if (nargs > UINT32_MAX)
+        return ACIRC_ERR;
+    rec = chunk_rec(ch, REC_GATE, ref);
+    rec->op = op;
+    rec->n = nargs;
+    rec->off = ch->nargs;
+    while (ch->nargs + nargs > ch->_args_alloc) {
+        ch->_args_alloc *= 2;
+        ch->args = acirc_realloc(ch->args, ch->_args_alloc * sizeof ch->args[0]);
+    }
+    memcpy(&ch->args[ch->nargs], args, nargs * sizeof args[0]);
+    ch->nargs += nargs;
+    return ACIRC_OK;
+}
+
+static int chunk_command(void *data, const char *name, const char **strs, size_t n)
+{
+    chunk_t *ch = data;
+    rec_t *rec = chunk_rec(ch, REC_COMMAND, 0);
+    rec->n = n;
+    rec->off = ch->nstrs;
+    chunk_strcat(ch, name);
+    for (size_t i = 0; i < n; ++i)
+        chunk_strcat(ch, strs[i]);
+    return ACIRC_OK;
+}
+
+static const acirc_callbacks_t chunk_cbs = {
+    .input = chunk_input,
+    .constant = chunk_const,
+    .gate = chunk_gate,
+    .command = chunk_command,
+};
+
+static void chunk_init(chunk_t *ch, acirc *c, const char *buf, size_t len)
+{
+    ch->c = c;
+    ch->buf = buf;
+    ch->len = len;
+    ch->nrecs = 0;
+    ch->_recs_alloc = 1024;
+    ch->recs = acirc_calloc(ch->_recs_alloc, sizeof ch->recs[0]);
+    ch->nargs = 0;
+    ch->_args_alloc = 2048;
+    ch->args = acirc_calloc(ch->_args_alloc, sizeof ch->args[0]);
+    ch->nstrs = 0;
+    ch->_strs_alloc = 256;
+    ch->strs = acirc_calloc(ch->_strs_alloc, sizeof ch->strs[0]);
+    lines_init(&ch->lines);
+    ch->lines.quiet = true;
+    ch->ret = ACIRC_OK;
+}
+
+static void chunk_clear(chunk_t *ch)
+{
+    free(ch->recs);
+    free(ch->args);
+    free(ch->strs);
+    ch->recs = NULL;
+    ch->args = NULL;
+    ch->strs = NULL;
+    lines_clear(&ch->lines);
+}
+
+static void * chunk_parse(void *vargs)
+{
+    chunk_t *ch = vargs;
+    ch->ret = lines_parse(&ch->lines, ch->buf, ch->len, &chunk_cbs, ch);
+    return NULL;
+}
+
+/* runs fn on every chunk, the first on this thread; a chunk whose thread
+ * fails to start is run here too */
+static void chunks_run(chunk_t *chunks, size_t n, void * (*fn)(void *))
+{
+    pthread_t *threads = acirc_calloc(n, sizeof threads[0]);
+    bool *started = acirc_calloc(n, sizeof started[0]);
+
+    for (size_t i = 1; i < n; ++i)
+        started[i] = pthread_create(&threads[i], NULL, fn, &chunks[i]) == 0;
+    fn(&chunks[0]);
+    for (size_t i = 1; i < n; ++i) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            fn(&chunks[i]);
+    }
+    free(threads);
+    free(started);
+}
+
+/* writes the chunk's inputs, consts and gates into the reserved arrays, and
+ * then drops its records */
+static void * chunk_place(void *vargs)
+{
+    chunk_t *ch = vargs;
+    acirc_gates_t *g = &ch->c->gates;
+    size_t off = ch->args_off;
+
+    for (size_t i = 0; i < ch->nrecs; ++i) {
+        const rec_t *rec = &ch->recs[i];
+        switch (rec->kind) {
+        case REC_INPUT:
+            g->ops[rec->ref] = OP_INPUT;
+            g->nargs[rec->ref] = 1;
+            g->offsets[rec->ref] = off;
+            g->args[off++] = rec->val;
+            break;
+        case REC_CONST:
+            g->ops[rec->ref] = OP_CONST;
+            g->nargs[rec->ref] = 2;
+            g->offsets[rec->ref] = off;
+            g->args[off++] = rec->off;
+            g->args[off++] = rec->val;
+            break;
+        case REC_GATE:
+            g->ops[rec->ref] = rec->op;
+            g->nargs[rec->ref] = rec->n;
+            g->offsets[rec->ref] = off;
+            memcpy(&g->args[off], &ch->args[rec->off], rec->n * sizeof ch->args[0]);
+            off += rec->n;
+            break;
+        }
+    }
+    free(ch->recs);
+    free(ch->args);
+    ch->recs = NULL;
+    ch->args = NULL;
+    return NULL;
+}
+
+/* the records through the builder functions, for hash-consing mode */
+static int chunk_replay(acirc *c, const chunk_t *ch)
+{
+    for (size_t i = 0; i < ch->nrecs; ++i) {
+        const rec_t *rec = &ch->recs[i];
+        int ret = ACIRC_OK;
+        switch (rec->kind) {
+        case REC_INPUT:
+            ret = acirc_add_input(c, rec->ref, rec->val);
+            break;
+        case REC_CONST:
+            ret = acirc_add_const(c, rec->ref, rec->val);
+            break;
+        case REC_GATE:
+            ret = acirc_add_gate(c, rec->ref, rec->op, &ch->args[rec->off], rec->n);
+            break;
+        }
+        if (ret != ACIRC_OK) {
+            fprintf(stderr, "error: unable to add ref %ld\n", (long) rec->ref);
+            return ACIRC_ERR;
+        }
+    }
+    return ACIRC_OK;
+}
+
+/* the commands, in file order; like the bison parser, a failing command is
+ * reported but not fatal */
+static void chunk_commands(acirc *c, const chunk_t *ch)
+{
+    size_t _strs_alloc = 0;
+    const char **strs = NULL;
+
+    for (size_t i = 0; i < ch->nrecs; ++i) {
+        const rec_t *rec = &ch->recs[i];
+        if (rec->kind == REC_COMMAND) {
+            const char *name = &ch->strs[rec->off];
+            const char *s = name + strlen(name) + 1;
+            if (rec->n > _strs_alloc) {
+                _strs_alloc = rec->n;
+                strs = acirc_realloc(strs, _strs_alloc * sizeof strs[0]);
+            }
+            for (size_t j = 0; j < rec->n; ++j) {
+                strs[j] = s;
+                s += strlen(s) + 1;
+            }
+            (void) acirc_add_command(c, name, strs, rec->n);
+        }
+    }
+    free(strs);
+}
+
+/* Rejects what acirc_add_input and acirc_add_const would, sums the arguments
+ * and the ref range of each chunk, and counts everything added, without
+ * touching c. */
+static int chunks_check(const acirc *c, chunk_t *chunks, size_t n, size_t *nargs,
+                        size_t *ninputs, size_t *nconsts, size_t *ngates)
+{
+    *nargs = *ninputs = *nconsts = *ngates = 0;
+    for (size_t i = 0; i < n; ++i) {
+        chunk_t *ch = &chunks[i];
+        ch->args_off = c->gates._args_n + *nargs;
+        ch->minref = ACIRC_REF_MAX;
+        ch->maxref = -1;
+        for (size_t j = 0; j < ch->nrecs; ++j) {
+            const rec_t *rec = &ch->recs[j];
+            if (rec->kind == REC_COMMAND)
+                continue;
+            if (rec->ref < 0 || (rec->kind == REC_CONST
+                                 && c->consts.n + *nconsts >= (size_t) ACIRC_REF_MAX)) {
+                fprintf(stderr, "error: unable to add ref %ld\n", (long) rec->ref);
+                return ACIRC_ERR;
+            }
+            if (rec->ref < ch->minref)
+                ch->minref = rec->ref;
+            if (rec->ref > ch->maxref)
+                ch->maxref = rec->ref;
+            switch (rec->kind) {
+            case REC_INPUT:
+                *nargs += 1;
+                (*ninputs)++;
+                break;
+            case REC_CONST:
+                *nargs += 2;
+                (*nconsts)++;
+                break;
+            case REC_GATE:
+                *nargs += rec->n;
+                (*ngates)++;
+                break;
+            }
+        }
+    }
+    return ACIRC_OK;
+}
+
+static int chunks_merge(acirc *c, chunk_t *chunks, size_t n)
+{
+    acirc_consts_t *k = &c->consts;
+    size_t nargs, ninputs, nconsts, ngates;
+    acircref maxref = -1, prev = -1;
+    bool disjoint = true;
+
+    if (c->hashcons) {
+        for (size_t i = 0; i < n; ++i) {
+            if (chunk_replay(c, &chunks[i]) != ACIRC_OK)
+                return ACIRC_ERR;
+            chunk_commands(c, &chunks[i]);
+        }
+        return ACIRC_OK;
+    }
+    if (chunks_check(c, chunks, n, &nargs, &ninputs, &nconsts, &ngates) != ACIRC_OK)
+        return ACIRC_ERR;
+
+    /* chunks may only write their gates concurrently if no ref is defined
+     * by two of them, which is certain when their ref ranges are in order */
+    for (size_t i = 0; i < n; ++i) {
+        if (chunks[i].maxref < 0)
+            continue;
+        if (chunks[i].minref <= prev)
+            disjoint = false;
+        prev = chunks[i].maxref;
+        if (chunks[i].maxref > maxref)
+            maxref = chunks[i].maxref;
+    }
+
+    /* consts are numbered in file order, as acirc_add_const would */
+    if (k->n + nconsts > k->_alloc) {
+        k->_alloc = k->n + nconsts;
+        k->buf = acirc_realloc(k->buf, k->_alloc * sizeof k->buf[0]);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < chunks[i].nrecs; ++j) {
+            rec_t *rec = &chunks[i].recs[j];
+            if (rec->kind == REC_CONST) {
+                rec->off = k->n;
+                k->buf[k->n++] = rec->val;
+            }
+        }
+        chunk_commands(c, &chunks[i]);
+    }
+
+    acirc_reserve(c, (size_t) (maxref + 1), c->gates._args_n + nargs);
+    acirc_invalidate(c);
+    c->gates._args_n += nargs;
+    c->ninputs += ninputs;
+    c->gates.n += ngates;
+    if (disjoint) {
+        chunks_run(chunks, n, chunk_place);
+    } else {
+        for (size_t i = 0; i < n; ++i)
+            chunk_place(&chunks[i]);
+    }
+    return ACIRC_OK;
+}
+
+static int read_chunks(acirc *c, const char *buf, size_t len, size_t nthreads)
+{
+    chunk_t *chunks = acirc_calloc(nthreads, sizeof chunks[0]);
+    size_t start = 0, lineno = 0;
+    int ret = ACIRC_OK;
+
+    for (size_t i = 0; i < nthreads; ++i) {
+        size_t end = (i == nthreads - 1) ? len : len / nthreads * (i + 1);
+        if (end < start)
+            end = start;
+        while (end > start && end < len && buf[end - 1] != '\n')
+            end++;
+        chunk_init(&chunks[i], c, buf + start, end - start);
+        start = end;
+    }
+    chunks_run(chunks, nthreads, chunk_parse);
+
+    for (size_t i = 0; i < nthreads; ++i) {
+        if (chunks[i].ret != ACIRC_OK) {
+            fprintf(stderr, "error: %lu: syntax error\n", lineno + chunks[i].lines.lineno);
+            ret = ACIRC_ERR;
+            break;
+        }
+        lineno += chunks[i].lines.lineno;
+    }
+    if (ret == ACIRC_OK)
+        ret = chunks_merge(c, chunks, nthreads);
+    for (size_t i = 0; i < nthreads; ++i)
+        chunk_clear(&chunks[i]);
+    free(chunks);
+    return ret;
+}
+
+acirc * acirc_fread_parallel(acirc *c, FILE *fp, size_t nthreads)
+{
+    bool mine = false;
+    struct stat st;
+    const off_t start = ftello(fp);
+    size_t len;
+    char *map;
+    int ret;
+
+    if (fstat(fileno(fp), &st) == -1 || !S_ISREG(st.st_mode) || start < 0
+        || st.st_size <= start)
+        return acirc_fread_fast(c, fp);
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (map == MAP_FAILED)
+        return acirc_fread_fast(c, fp);
+
+    len = st.st_size - start;
+    if (nthreads == 0) {
+        const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? ncpus : 1;
+        if (nthreads > len / CHUNK_MIN + 1)
+            nthreads = len / CHUNK_MIN + 1;
+    }
+    if (c == NULL) {
+        c = acirc_calloc(1, sizeof c[0]);
+        acirc_init(c);
+        mine = true;
+    }
+    ret = read_chunks(c, map + start, len, nthreads);
+    munmap(map, st.st_size);
+    (void) fseeko(fp, 0, SEEK_END);
+    if (ret != ACIRC_OK) {
+        if (mine) {
+            acirc_clear(c);
+            free(c);
+        }
+        return NULL;
+    }
+    return c;
+}
@@ -11,11 +11,14 @@ typedef struct {
 
 static int acirc_add_obf_public(acirc *c, const char **strs, size_t n)
 {
-    acirc_obf_public_t *s = acirc_calloc(1, sizeof s[0]);
-    s->refs = acirc_calloc(n, sizeof s->refs[0]);
+    acirc_obf_public_t *s = acirc_arena_alloc(&c->arena, sizeof s[0]);
+    s->refs = acirc_arena_calloc(&c->arena, n, sizeof s->refs[0]);
     s->n = n;
     for (size_t i = 0; i < n; ++i) {
-        s->refs[i] = atoi(strs[i]);
+        if (str2ref(strs[i], &s->refs[i]) == ACIRC_ERR) {
+            fprintf(stderr, "'%s' not a valid wire\n", strs[i]);
+            return ACIRC_ERR;
+        }
     }
     acirc_add_extra(&c->extras, "obf-public", s);
     return ACIRC_OK;
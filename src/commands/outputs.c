@@ -12,10 +12,17 @@ static int acirc_add_outputs(acirc *c, const char **strs, size_t n)
         return ACIRC_ERR;
     }
     assert(outputs->buf == NULL);
+    acirc_invalidate_stats(c);
     outputs->n = n;
     outputs->buf = acirc_calloc(n, sizeof outputs->buf[0]);
     for (size_t i = 0; i < n; ++i) {
-        outputs->buf[i] = atoi(strs[i]);
+        if (str2ref(strs[i], &outputs->buf[i]) == ACIRC_ERR) {
+            fprintf(stderr, "'%s' not a valid wire\n", strs[i]);
+            free(outputs->buf);
+            outputs->buf = NULL;
+            outputs->n = 0;
+            return ACIRC_ERR;
+        }
     }
     return ACIRC_OK;
 }
@@ -25,7 +32,7 @@ void acirc_add_outputs_to_file(const acirc_outputs_t *o, FILE *f)
 {
     fprintf(f, ":outputs");
     for (size_t i = 0; i < o->n; ++i) {
-        fprintf(f, " %ld", o->buf[i]);
+        fprintf(f, " %ld", (long) o->buf[i]);
     }
     fprintf(f, "\n");
 }
@@ -2,7 +2,6 @@
 #include "utils.h"
 
 #include <assert.h>
-#include <limits.h>
 #include <stdlib.h>
 
 static int
@@ -15,12 +14,12 @@ acirc_add_secrets(acirc *c, const char **strs, size_t n)
     }
     assert(s->list == NULL);
     s->n = n;
-    s->list = acirc_calloc(n, sizeof s->list[0]);
+    s->list = acirc_arena_calloc(&c->arena, n, sizeof s->list[0]);
     for (size_t i = 0; i < n; ++i) {
-        s->list[i] = strtol(strs[i], NULL, 10);
-        if (s->list[i] == LONG_MIN || s->list[i] == LONG_MAX) {
+        if (str2ref(strs[i], &s->list[i]) == ACIRC_ERR) {
             fprintf(stderr, "'%s' not a valid wire\n", strs[i]);
-            free(s);
+            s->n = 0;
+            s->list = NULL;
             return ACIRC_ERR;
         }
     }
@@ -33,7 +32,7 @@ void acirc_add_secrets_to_file(const acirc_secrets_t *s, FILE *f)
 {
     fprintf(f, ":secrets");
     for (size_t i = 0; i < s->n; ++i) {
-        fprintf(f, " %ld", s->list[i]);
+        fprintf(f, " %ld", (long) s->list[i]);
     }
     fprintf(f, "\n");
 }
@@ -32,8 +32,8 @@ static int acirc_add_test(acirc *c, const char **strs, size_t n)
 
     const size_t inp_len = strlen(strs[0]);
     const size_t out_len = strlen(strs[1]);
-    int *inp = acirc_calloc(inp_len, sizeof inp[0]);
-    int *out = acirc_calloc(out_len, sizeof out[0]);
+    int *inp = acirc_arena_calloc(&c->arena, inp_len, sizeof inp[0]);
+    int *out = acirc_arena_calloc(&c->arena, out_len, sizeof out[0]);
 
     for (size_t i = 0; i < inp_len; i++) {
         inp[i] = char_to_int(strs[0][inp_len - 1 - i]);
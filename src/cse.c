@@ -0,0 +1,156 @@
+#include "cse.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+cse_t * cse_new(void)
+{
+    cse_t *t = acirc_calloc(1, sizeof t[0]);
+    t->nslots = 1024;
+    t->slots = acirc_calloc(t->nslots, sizeof t->slots[0]);
+    for (size_t i = 0; i < t->nslots; ++i)
+        t->slots[i].ref = -1;
+    t->_args_alloc = 4096;
+    t->args = acirc_calloc(t->_args_alloc, sizeof t->args[0]);
+    return t;
+}
+
+void cse_free(cse_t *t)
+{
+    if (t) {
+        free(t->slots);
+        free(t->args);
+        free(t->alias);
+        free(t->key);
+        free(t);
+    }
+}
+
+acircref cse_resolve(const cse_t *t, acircref ref)
+{
+    if (ref >= 0 && (size_t) ref < t->_alias_alloc && t->alias[ref] != -1)
+        return t->alias[ref];
+    return ref;
+}
+
+/* to must already be resolved, so aliases never chain */
+void cse_alias(cse_t *t, acircref ref, acircref to)
+{
+    if ((size_t) ref >= t->_alias_alloc) {
+        size_t alloc = t->_alias_alloc ? t->_alias_alloc : 1024;
+        while ((size_t) ref >= alloc)
+            alloc *= 2;
+        t->alias = acirc_realloc(t->alias, alloc * sizeof t->alias[0]);
+        for (size_t i = t->_alias_alloc; i < alloc; ++i)
+            t->alias[i] = -1;
+        t->_alias_alloc = alloc;
+    }
+    t->alias[ref] = to;
+}
+
+static int ref_cmp(const void *a, const void *b)
+{
+    const acircref x = *(const acircref *) a, y = *(const acircref *) b;
+    return (x > y) - (x < y);
+}
+
+static void sort_refs(acircref *refs, size_t n)
+{
+    if (n > 16) {
+        qsort(refs, n, sizeof refs[0], ref_cmp);
+        return;
+    }
+    for (size_t i = 1; i < n; ++i) {
+        const acircref x = refs[i];
+        size_t j = i;
+        for (; j > 0 && refs[j - 1] > x; --j)
+            refs[j] = refs[j - 1];
+        refs[j] = x;
+    }
+}
+
+static void cse_normalize(cse_t *t, acirc_operation op, const acircref *args, size_t n)
+{
+    if (op == OP_SET && n > 1)
+        n = 1;
+    if (n > t->_key_alloc) {
+        t->_key_alloc = n;
+        t->key = acirc_realloc(t->key, t->_key_alloc * sizeof t->key[0]);
+    }
+    /* a constant's key is its value, not a ref */
+    for (size_t i = 0; i < n; ++i)
+        t->key[i] = op == OP_CONST ? args[i] : cse_resolve(t, args[i]);
+    t->nkey = n;
+    if (op == OP_ADD || op == OP_MUL)
+        sort_refs(t->key, n);
+    else if (op == OP_SUB && n > 1)
+        sort_refs(t->key + 1, n - 1);
+}
+
+static uint64_t cse_hash(acirc_operation op, const acircref *key, size_t n)
+{
+    uint64_t h = (uint64_t) op << 32 | n;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (uint64_t) key[i];
+        h *= 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static void cse_grow(cse_t *t)
+{
+    cse_slot_t *old = t->slots;
+    const size_t nold = t->nslots;
+
+    t->nslots *= 2;
+    t->slots = acirc_calloc(t->nslots, sizeof t->slots[0]);
+    for (size_t i = 0; i < t->nslots; ++i)
+        t->slots[i].ref = -1;
+    for (size_t i = 0; i < nold; ++i) {
+        size_t j;
+        if (old[i].ref == -1)
+            continue;
+        for (j = old[i].hash & (t->nslots - 1); t->slots[j].ref != -1;
+             j = (j + 1) & (t->nslots - 1))
+            ;
+        t->slots[j] = old[i];
+    }
+    free(old);
+}
+
+acircref cse_intern(cse_t *t, acirc_operation op, const acircref *args,
+                    size_t n, acircref ref)
+{
+    uint64_t hash;
+    size_t i;
+
+    cse_normalize(t, op, args, n);
+    hash = cse_hash(op, t->key, t->nkey);
+    for (i = hash & (t->nslots - 1); t->slots[i].ref != -1; i = (i + 1) & (t->nslots - 1)) {
+        const cse_slot_t *s = &t->slots[i];
+        if (s->hash == hash && s->op == op && s->nargs == t->nkey
+            && (t->nkey == 0
+                || memcmp(&t->args[s->off], t->key, t->nkey * sizeof t->key[0]) == 0))
+            return s->ref;
+    }
+
+    if (t->_args_n + t->nkey > t->_args_alloc) {
+        while (t->_args_n + t->nkey > t->_args_alloc)
+            t->_args_alloc *= 2;
+        t->args = acirc_realloc(t->args, t->_args_alloc * sizeof t->args[0]);
+    }
+    if (t->nkey)
+        memcpy(&t->args[t->_args_n], t->key, t->nkey * sizeof t->key[0]);
+    t->slots[i].hash = hash;
+    t->slots[i].off = t->_args_n;
+    t->slots[i].nargs = t->nkey;
+    t->slots[i].op = op;
+    t->slots[i].ref = ref;
+    t->_args_n += t->nkey;
+    /* kept at most half full, so probes stay short */
+    if (++t->n * 2 > t->nslots)
+        cse_grow(t);
+    return ref;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "acirc.h"
+
+/* Table of gates keyed by structure, for common-subexpression elimination.
+ * A key is an op and its arguments after normalization: arguments are first
+ * replaced by the ref they alias, if any, and then the arguments of ADD and
+ * MUL, and all but the first argument of SUB, are sorted, since their order
+ * doesn't matter.  SET keys keep just the first argument. */
+typedef struct {
+    uint64_t hash;
+    size_t off;                 /* start of the key's arguments in args */
+    uint32_t nargs;
+    uint8_t op;
+    acircref ref;               /* -1 if the slot is empty */
+} cse_slot_t;
+
+typedef struct acirc_cse {
+    cse_slot_t *slots;
+    size_t nslots;              /* a power of two */
+    size_t n;
+    acircref *args;
+    size_t _args_n;
+    size_t _args_alloc;
+    acircref *alias;            /* the ref each ref stands for, or -1 */
+    size_t _alias_alloc;
+    acircref *key;              /* normalized arguments of the last lookup */
+    size_t nkey;
+    size_t _key_alloc;
+} cse_t;
+
+cse_t * cse_new(void);
+void cse_free(cse_t *t);
+acircref cse_resolve(const cse_t *t, acircref ref);
+void cse_alias(cse_t *t, acircref ref, acircref to);
+/* the ref of a gate equal to (op, args), or ref after recording (op, args)
+ * under it; the normalized arguments are left in t->key */
+acircref cse_intern(cse_t *t, acirc_operation op, const acircref *args,
+                    size_t n, acircref ref);
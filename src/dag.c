@@ -0,0 +1,166 @@
+#include "plan.h"
+#include "pool.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/* Dependency-driven evaluation.  Every step carries a counter of argument
+ * edges still outstanding; when it drops to zero the step is ready and is
+ * pushed onto the deque of the thread that finished its last argument.
+ * Threads pop their own work newest-first, which keeps a chain of dependent
+ * gates on one core, and steal oldest-first from the others when they run
+ * dry.  Deques are guarded by a mutex each: the driver is meant for gates
+ * that cost far more than a lock.  A thread that finds nothing to steal
+ * sleeps until a step is pushed or the evaluation ends, so a narrow frontier
+ * of expensive gates doesn't keep the idle threads spinning. */
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *buf;
+    size_t head, tail, _alloc;
+} deque_t;
+
+typedef struct {
+    acirc_pool *pool;
+    acirc_plan *p;
+    acirc_gate_fn fn;
+    void *data;
+    deque_t *deques;
+    atomic_uint *npreds;
+    atomic_size_t ndone;
+    atomic_bool failed;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle;
+    atomic_size_t npushed;      /* bumped after every push */
+    atomic_size_t nidle;        /* threads asleep, or about to be, on idle */
+} dag_t;
+
+static void deque_push(deque_t *d, size_t step)
+{
+    pthread_mutex_lock(&d->lock);
+    if (d->head == d->tail)
+        d->head = d->tail = 0;
+    if (d->tail == d->_alloc) {
+        d->_alloc = d->_alloc ? 2 * d->_alloc : 64;
+        d->buf = acirc_realloc(d->buf, d->_alloc * sizeof d->buf[0]);
+    }
+    d->buf[d->tail++] = step;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static bool deque_pop(deque_t *d, size_t *step, bool steal)
+{
+    bool ok = false;
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail) {
+        *step = steal ? d->buf[d->head++] : d->buf[--d->tail];
+        ok = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static bool dag_finished(dag_t *dag)
+{
+    return atomic_load(&dag->ndone) == dag->p->n || atomic_load(&dag->failed);
+}
+
+/* Wakes one sleeper for a new step, or all of them at the end.  A pusher
+ * bumps npushed before reading nidle and a sleeper bumps nidle before
+ * reading npushed, so at least one of the two sees the other. */
+static void dag_wake(dag_t *dag, bool all)
+{
+    if (atomic_load(&dag->nidle) == 0)
+        return;
+    pthread_mutex_lock(&dag->idle_lock);
+    if (all)
+        pthread_cond_broadcast(&dag->idle);
+    else
+        pthread_cond_signal(&dag->idle);
+    pthread_mutex_unlock(&dag->idle_lock);
+}
+
+static void dag_sleep(dag_t *dag, size_t seen)
+{
+    pthread_mutex_lock(&dag->idle_lock);
+    atomic_fetch_add(&dag->nidle, 1);
+    while (atomic_load(&dag->npushed) == seen && !dag_finished(dag))
+        pthread_cond_wait(&dag->idle, &dag->idle_lock);
+    atomic_fetch_sub(&dag->nidle, 1);
+    pthread_mutex_unlock(&dag->idle_lock);
+}
+
+static void dag_worker(void *vargs, size_t tid)
+{
+    dag_t *dag = vargs;
+    const acirc_plan *p = dag->p;
+    const size_t nthreads = pool_nthreads(dag->pool);
+    deque_t *mine = &dag->deques[tid];
+
+    while (!dag_finished(dag)) {
+        const size_t seen = atomic_load(&dag->npushed);
+        size_t step;
+        bool found = deque_pop(mine, &step, false);
+        for (size_t k = 1; !found && k < nthreads; ++k)
+            found = deque_pop(&dag->deques[(tid + k) % nthreads], &step, true);
+        if (!found) {
+            dag_sleep(dag, seen);
+            continue;
+        }
+        if (dag->fn(dag->data, p->refs[step]) != ACIRC_OK) {
+            atomic_store(&dag->failed, true);
+            dag_wake(dag, true);
+        }
+        for (size_t j = p->succ_offsets[step]; j < p->succ_offsets[step + 1]; ++j) {
+            const size_t succ = p->succs[j];
+            if (atomic_fetch_sub(&dag->npreds[succ], 1) == 1) {
+                deque_push(mine, succ);
+                atomic_fetch_add(&dag->npushed, 1);
+                dag_wake(dag, false);
+            }
+        }
+        if (atomic_fetch_add(&dag->ndone, 1) + 1 == p->n)
+            dag_wake(dag, true);
+    }
+}
+
+int acirc_eval_dag(acirc_pool *pool, acirc_plan *p, acirc_gate_fn fn, void *data)
+{
+    const size_t nthreads = pool_nthreads(pool);
+    size_t next = 0;
+    dag_t dag;
+
+    plan_dag(p);
+    dag.pool = pool;
+    dag.p = p;
+    dag.fn = fn;
+    dag.data = data;
+    atomic_init(&dag.ndone, 0);
+    atomic_init(&dag.failed, false);
+    atomic_init(&dag.npushed, 0);
+    atomic_init(&dag.nidle, 0);
+    pthread_mutex_init(&dag.idle_lock, NULL);
+    pthread_cond_init(&dag.idle, NULL);
+    dag.npreds = acirc_calloc(p->n + 1, sizeof dag.npreds[0]);
+    dag.deques = acirc_calloc(nthreads, sizeof dag.deques[0]);
+    for (size_t t = 0; t < nthreads; ++t)
+        pthread_mutex_init(&dag.deques[t].lock, NULL);
+    /* the initially ready steps are dealt out round-robin */
+    for (size_t i = 0; i < p->n; ++i) {
+        atomic_init(&dag.npreds[i], p->npreds[i]);
+        if (p->npreds[i] == 0)
+            deque_push(&dag.deques[next++ % nthreads], i);
+    }
+    pool_run(pool, dag_worker, &dag);
+    for (size_t t = 0; t < nthreads; ++t) {
+        pthread_mutex_destroy(&dag.deques[t].lock);
+        free(dag.deques[t].buf);
+    }
+    pthread_mutex_destroy(&dag.idle_lock);
+    pthread_cond_destroy(&dag.idle);
+    free(dag.deques);
+    free(dag.npreds);
+    return atomic_load(&dag.failed) ? ACIRC_ERR : ACIRC_OK;
+}
@@ -0,0 +1,111 @@
+#include "plan.h"
+#include "pool.h"
+#include "utils.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/* Degree of the outputs in every input at once.  Column id < ninputs is the
+ * degree in input id and column ninputs the degree in the constants, with
+ * the same rules as acirc_var_degree and acirc_const_degree.  One sweep over
+ * the plan carries a block of columns side by side in each live slot, so the
+ * memory used is the plan's width times the block size, and the threads of
+ * the pool take blocks in turn. */
+
+#define DEG_BLOCK 64
+
+typedef struct {
+    const acirc_plan *p;
+    size_t ncols;
+    atomic_size_t next;         /* next unclaimed block */
+    size_t *degs;
+} degrees_t;
+
+static void deg_block(const acirc_plan *p, size_t *vals, size_t lo, size_t w,
+                      size_t *degs)
+{
+    const size_t ninputs = p->c->ninputs;
+    const acircref *args = p->args;
+
+    for (size_t i = 0; i < p->n; ++i) {
+        size_t *restrict dst = &vals[p->slots[i] * DEG_BLOCK];
+        const size_t n = p->nargs[i];
+        switch (p->ops[i]) {
+        case OP_INPUT:
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = lo + l != ninputs && (size_t) args[0] == lo + l;
+            break;
+        case OP_CONST:
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = lo + l == ninputs;
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_SET:
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = 0;
+            for (size_t j = 0; j < n; ++j) {
+                const size_t *a = &vals[args[j] * DEG_BLOCK];
+                if (p->ops[i] == OP_MUL)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] += a[l];
+                else
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] = dst[l] > a[l] ? dst[l] : a[l];
+                if (p->ops[i] == OP_SET)
+                    break;
+            }
+            break;
+        default:
+            abort();
+        }
+        args += n;
+    }
+    for (size_t l = 0; l < w; ++l)
+        degs[lo + l] = 0;
+    for (size_t o = 0; o < p->noutputs; ++o) {
+        const size_t *v = &vals[p->outputs[o] * DEG_BLOCK];
+        for (size_t l = 0; l < w; ++l)
+            degs[lo + l] = degs[lo + l] > v[l] ? degs[lo + l] : v[l];
+    }
+}
+
+static void degrees_worker(void *vargs, size_t tid)
+{
+    degrees_t *d = vargs;
+    size_t *vals = acirc_calloc((d->p->nslots + 1) * DEG_BLOCK, sizeof vals[0]);
+    (void) tid;
+
+    for (;;) {
+        const size_t lo = atomic_fetch_add(&d->next, 1) * DEG_BLOCK;
+        if (lo >= d->ncols)
+            break;
+        deg_block(d->p, vals, lo, d->ncols - lo < DEG_BLOCK ? d->ncols - lo : DEG_BLOCK,
+                  d->degs);
+    }
+    free(vals);
+}
+
+void acirc_max_degrees(acirc_pool *pool, acirc_plan *p, size_t *degs)
+{
+    degrees_t d;
+
+    d.p = p;
+    d.ncols = p->c->ninputs + 1;
+    atomic_init(&d.next, 0);
+    d.degs = degs;
+    if (pool)
+        pool_run(pool, degrees_worker, &d);
+    else
+        degrees_worker(&d, 0);
+}
+
+/* acirc_max_degrees over a plan of c's outputs, into degs[0 .. ninputs] */
+void circuit_degrees(const acirc *c, acirc_pool *pool, size_t *degs)
+{
+    acirc_plan *p = acirc_plan_new(c);
+
+    /* threads only help once there are several blocks */
+    if (c->ninputs + 1 <= DEG_BLOCK)
+        pool = NULL;
+    acirc_max_degrees(pool, p, degs);
+    acirc_plan_free(p);
+}
@@ -0,0 +1,76 @@
+#include "acirc.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Reverse-edge index, built with two passes over the argument arrays: one
+ * to count the consumers of each ref, and one to fill them in.  Arguments
+ * naming refs that don't exist are skipped. */
+
+static acirc_fanout_t * fanout_build(const acirc *c)
+{
+    const size_t nrefs = acirc_nrefs(c);
+    acirc_fanout_t *f = acirc_calloc(1, sizeof f[0]);
+    size_t *pos;
+
+    f->n = nrefs;
+    f->offsets = acirc_calloc(nrefs + 1, sizeof f->offsets[0]);
+    for (size_t ref = 0; ref < nrefs; ++ref) {
+        const acirc_operation op = acirc_op(c, ref);
+        const acircref *args = acirc_args(c, ref);
+        if (op == OP_INPUT || op == OP_CONST)
+            continue;
+        for (size_t i = 0; i < acirc_nargs(c, ref); ++i)
+            if (args[i] >= 0 && (size_t) args[i] < nrefs)
+                f->offsets[args[i] + 1]++;
+    }
+    for (size_t ref = 0; ref < nrefs; ++ref)
+        f->offsets[ref + 1] += f->offsets[ref];
+
+    f->refs = acirc_calloc(f->offsets[nrefs] + 1, sizeof f->refs[0]);
+    pos = acirc_calloc(nrefs + 1, sizeof pos[0]);
+    memcpy(pos, f->offsets, nrefs * sizeof pos[0]);
+    for (size_t ref = 0; ref < nrefs; ++ref) {
+        const acirc_operation op = acirc_op(c, ref);
+        const acircref *args = acirc_args(c, ref);
+        if (op == OP_INPUT || op == OP_CONST)
+            continue;
+        for (size_t i = 0; i < acirc_nargs(c, ref); ++i)
+            if (args[i] >= 0 && (size_t) args[i] < nrefs)
+                f->refs[pos[args[i]]++] = ref;
+    }
+    free(pos);
+    return f;
+}
+
+static void fanout_free(acirc_fanout_t *f)
+{
+    if (f) {
+        free(f->offsets);
+        free(f->refs);
+        free(f);
+    }
+}
+
+const acirc_fanout_t * acirc_fanout(acirc *c)
+{
+    if (c->fanout == NULL)
+        c->fanout = fanout_build(c);
+    return c->fanout;
+}
+
+const acircref * acirc_consumers(acirc *c, acircref ref, size_t *n)
+{
+    const acirc_fanout_t *f = acirc_fanout(c);
+    *n = f->offsets[ref + 1] - f->offsets[ref];
+    return &f->refs[f->offsets[ref]];
+}
+
+/* drops everything computed from the gates; called by the builders */
+void acirc_invalidate(acirc *c)
+{
+    fanout_free(c->fanout);
+    c->fanout = NULL;
+    acirc_invalidate_stats(c);
+}
@@ -2,79 +2,100 @@
 
 #ifdef HAVE_GMP
 
+#include "plan.h"
 #include "utils.h"
+#include "walk.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void
-acirc_eval_mpz_mod_memo(acirc *c, acircref root, mpz_t *xs, mpz_t *ys,
-                        const mpz_t modulus, bool *known, mpz_t *cache)
-{
-    if (known[root])
-        return;
+typedef struct {
+    mpz_t *xs, *ys;
+    mpz_srcptr modulus;
+    bool *known;                /* NULL if cache is already initialized */
+    mpz_t *cache;
+} mpz_walk_t;
 
-    const acirc_gate_t *gate = &c->gates.gates[root];
-    const acirc_operation op = gate->op;
-    mpz_t *rop;
+static void mpz_fn(void *data, const acirc *c, acircref ref)
+{
+    mpz_walk_t *m = data;
+    mpz_t *cache = m->cache;
+    const acirc_gate_t gate = acirc_gate(c, ref);
+    const acirc_operation op = gate.op;
+    mpz_t *rop = &cache[ref];
+    if (m->known)
+        mpz_init(*rop);
     switch (op) {
     case OP_INPUT:
-        mpz_init_set(cache[root], xs[gate->args[0]]);
+        mpz_set(*rop, m->xs[gate.args[0]]);
         break;
     case OP_CONST:
-        mpz_init_set(cache[root], ys[gate->args[0]]);
+        mpz_set(*rop, m->ys[gate.args[0]]);
+        break;
+    case OP_ADD:
+        mpz_set_ui(*rop, 0);
+        for (size_t i = 0; i < gate.nargs; ++i)
+            mpz_add(*rop, *rop, cache[gate.args[i]]);
+        mpz_mod(*rop, *rop, m->modulus);
         break;
-    case OP_ADD: case OP_SUB: case OP_MUL: {
-        mpz_init(cache[root]);
-        rop = &cache[root];
-        for (size_t i = 0; i < gate->nargs; ++i) {
-            acirc_eval_mpz_mod_memo(c, gate->args[i], xs, ys, modulus, known, cache);
+    case OP_SUB:
+        mpz_set(*rop, cache[gate.args[0]]);
+        for (size_t i = 1; i < gate.nargs; ++i)
+            mpz_sub(*rop, *rop, cache[gate.args[i]]);
+        mpz_mod(*rop, *rop, m->modulus);
+        break;
+    case OP_MUL:
+        mpz_set_ui(*rop, 1);
+        for (size_t i = 0; i < gate.nargs; ++i) {
+            mpz_mul(*rop, *rop, cache[gate.args[i]]);
+            mpz_mod(*rop, *rop, m->modulus);
         }
-        if (op == OP_ADD) {
-            mpz_set_ui(*rop, 0);
-            for (size_t i = 0; i < gate->nargs; ++i) {
-                mpz_add(*rop, *rop, cache[gate->args[i]]);
-                mpz_mod(*rop, *rop, modulus);
-            }
-        } else if (op == OP_SUB) {
-            mpz_set(*rop, cache[gate->args[0]]);
-            for (size_t i = 1; i < gate->nargs; ++i) {
-                mpz_sub(*rop, *rop, cache[gate->args[i]]);
-                mpz_mod(*rop, *rop, modulus);
-            }
-        } else if (op == OP_MUL) {
-            mpz_set_ui(*rop, 1);
-            for (size_t i = 0; i < gate->nargs; ++i) {
-                mpz_mul(*rop, *rop, cache[gate->args[i]]);
-                mpz_mod(*rop, *rop, modulus);
-            }
-        } else abort();
-        known[root] = true;
         break;
-    }
     case OP_SET:
-        acirc_eval_mpz_mod_memo(c, gate->args[0], xs, ys, modulus, known, cache);
-        mpz_init_set(cache[root], cache[gate->args[0]]);
+        mpz_set(*rop, cache[gate.args[0]]);
         break;
     default:
         abort();
     }
+    if (m->known)
+        m->known[ref] = true;
 }
 
+void
+acirc_eval_mpz_mod_memo(acirc *c, acircref root, mpz_t *xs, mpz_t *ys,
+                        const mpz_t modulus, bool *known, mpz_t *cache)
+{
+    walk_t *w = walk_acquire(c);
+    mpz_walk_t m = {
+        .xs = xs, .ys = ys, .modulus = modulus, .known = known, .cache = cache,
+    };
+    walk_begin(w, c);
+    walk_from(w, c, root, known, mpz_fn, &m);
+    walk_release(c, w);
+}
+
+/* The walk's visited marks say which refs were evaluated, and its mpz values
+ * are kept between calls and overwritten with mpz_set, so once they cover
+ * the circuit a call allocates nothing beyond what GMP needs to grow them. */
 void
 acirc_eval_mpz_mod(mpz_t rop, acirc *c, acircref root, mpz_t *xs, mpz_t *ys,
                    const mpz_t modulus)
 {
-    bool known[acirc_nrefs(c)];
-    mpz_t cache[acirc_nrefs(c)];
-    memset(known, '\0', sizeof known);
-    acirc_eval_mpz_mod_memo(c, root, xs, ys, modulus, known, cache);
-    mpz_set(rop, cache[root]);
-    for (size_t i = 0; i < acirc_nrefs(c); ++i) {
-        if (known[i])
-            mpz_clear(cache[i]);
+    walk_t *w = walk_acquire(c);
+    mpz_walk_t m = { .xs = xs, .ys = ys, .modulus = modulus };
+
+    walk_begin(w, c);
+    if (w->_mpz_n < w->_alloc) {
+        w->mpz = acirc_realloc(w->mpz, w->_alloc * sizeof w->mpz[0]);
+        for (size_t i = w->_mpz_n; i < w->_alloc; ++i)
+            mpz_init(w->mpz[i]);
+        w->_mpz_n = w->_alloc;
     }
+    m.cache = w->mpz;
+    walk_from(w, c, root, NULL, mpz_fn, &m);
+    mpz_set(rop, m.cache[root]);
+    walk_release(c, w);
 }
 
 static void array_printstring_rev_mpz(mpz_t *xs, size_t n)
@@ -84,6 +105,135 @@ static void array_printstring_rev_mpz(mpz_t *xs, size_t n)
 }
 
 
+/* Plan-based evaluation context.  Values live in one preallocated mpz per
+ * plan slot, sized for a product of two reduced values, so that repeated
+ * evaluations do no allocation.  Reduction is lazy: a value is only reduced
+ * once it grows past the modulus by more than a limb, and the outputs are
+ * brought into [0, modulus) at the end, which gives the same results as
+ * reducing after every operation.  As in acirc_eval_mpz_mod, an output that
+ * just copies an input or constant, directly or through SETs, is returned
+ * as given rather than reduced. */
+struct acirc_mpz_ctx {
+    acirc_plan *p;
+    mpz_t modulus;
+    size_t limbs;               /* reduce values longer than this */
+    mpz_t *vals;                /* indexed by slot */
+    acircref *copies;           /* per output, the INPUT or CONST ref it
+                                 * copies, or -1 */
+};
+
+/* the input or constant ref is a copy of, following SETs, or -1 */
+static acircref copy_source(const acirc *c, acircref ref)
+{
+    for (size_t k = 0; k <= acirc_nrefs(c); ++k) {
+        switch (acirc_op(c, ref)) {
+        case OP_INPUT: case OP_CONST:
+            return ref;
+        case OP_SET:
+            if (acirc_nargs(c, ref) == 0)
+                return -1;
+            ref = acirc_args(c, ref)[0];
+            break;
+        default:
+            return -1;
+        }
+    }
+    return -1;
+}
+
+acirc_mpz_ctx * acirc_mpz_ctx_new(acirc_plan *p, const mpz_t modulus)
+{
+    acirc_mpz_ctx *ctx = acirc_calloc(1, sizeof ctx[0]);
+    const mp_bitcnt_t bits = 2 * (mpz_size(modulus) + 1) * GMP_NUMB_BITS;
+
+    ctx->p = p;
+    mpz_init_set(ctx->modulus, modulus);
+    ctx->limbs = mpz_size(modulus) + 1;
+    ctx->vals = acirc_calloc(p->nslots + 1, sizeof ctx->vals[0]);
+    for (size_t i = 0; i < p->nslots + 1; ++i)
+        mpz_init2(ctx->vals[i], bits);
+    ctx->copies = acirc_calloc(p->noutputs + 1, sizeof ctx->copies[0]);
+    for (size_t o = 0; o < p->noutputs; ++o)
+        ctx->copies[o] = copy_source(p->c, p->c->outputs.buf[o]);
+    return ctx;
+}
+
+void acirc_mpz_ctx_free(acirc_mpz_ctx *ctx)
+{
+    if (ctx == NULL)
+        return;
+    for (size_t i = 0; i < ctx->p->nslots + 1; ++i)
+        mpz_clear(ctx->vals[i]);
+    free(ctx->vals);
+    free(ctx->copies);
+    mpz_clear(ctx->modulus);
+    free(ctx);
+}
+
+static inline void ctx_reduce(const acirc_mpz_ctx *ctx, mpz_ptr x)
+{
+    if (mpz_size(x) > ctx->limbs)
+        mpz_tdiv_r(x, x, ctx->modulus);
+}
+
+int acirc_eval_mpz_ctx(acirc_mpz_ctx *ctx, mpz_t *rops, mpz_t *xs, mpz_t *ys)
+{
+    const acirc_plan *p = ctx->p;
+    const acircref *args = p->args;
+    mpz_t *vals = ctx->vals;
+
+    for (size_t i = 0; i < p->n; ++i) {
+        mpz_ptr rop = vals[p->slots[i]];
+        const size_t n = p->nargs[i];
+        switch (p->ops[i]) {
+        case OP_INPUT:
+            mpz_set(rop, xs[args[0]]);
+            break;
+        case OP_CONST:
+            mpz_set(rop, ys[args[0]]);
+            break;
+        case OP_ADD:
+            mpz_set_ui(rop, 0);
+            for (size_t j = 0; j < n; ++j)
+                mpz_add(rop, rop, vals[args[j]]);
+            break;
+        case OP_SUB:
+            if (n == 0)
+                return ACIRC_ERR;
+            mpz_set(rop, vals[args[0]]);
+            for (size_t j = 1; j < n; ++j)
+                mpz_sub(rop, rop, vals[args[j]]);
+            break;
+        case OP_MUL:
+            mpz_set_ui(rop, 1);
+            for (size_t j = 0; j < n; ++j) {
+                mpz_mul(rop, rop, vals[args[j]]);
+                ctx_reduce(ctx, rop);
+            }
+            break;
+        case OP_SET:
+            if (n == 0)
+                return ACIRC_ERR;
+            mpz_set(rop, vals[args[0]]);
+            break;
+        default:
+            return ACIRC_ERR;
+        }
+        ctx_reduce(ctx, rop);
+        args += n;
+    }
+    for (size_t o = 0; o < p->noutputs; ++o) {
+        const acircref ref = ctx->copies[o];
+        if (ref == -1)
+            mpz_mod(rops[o], vals[p->outputs[o]], ctx->modulus);
+        else if (acirc_op(p->c, ref) == OP_INPUT)
+            mpz_set(rops[o], xs[acirc_args(p->c, ref)[0]]);
+        else
+            mpz_set(rops[o], ys[acirc_args(p->c, ref)[0]]);
+    }
+    return ACIRC_OK;
+}
+
 bool acirc_ensure_mpz(acirc *c)
 {
     bool ok = true;
@@ -92,6 +242,8 @@ bool acirc_ensure_mpz(acirc *c)
     mpz_t rs[c->outputs.n];
     mpz_t modulus;
     const acirc_tests_t *tests = &c->tests;
+    acirc_plan *plan = acirc_plan_new(c);
+    acirc_mpz_ctx *ctx;
 
     if (g_verbose)
         fprintf(stderr, "running acirc tests...\n");
@@ -103,15 +255,15 @@ bool acirc_ensure_mpz(acirc *c)
     for (size_t i = 0; i < c->outputs.n; ++i)
         mpz_init(rs[i]);
     mpz_init_set_ui(modulus, 23); /* XXX: why 23? */
+    ctx = acirc_mpz_ctx_new(plan, modulus);
 
     for (size_t test_num = 0; test_num < tests->n; test_num++) {
-        bool test_ok = true;
+        bool test_ok;
         for (size_t i = 0; i < c->ninputs; ++i)
             mpz_set_ui(xs[i], tests->inps[test_num][i]);
-        for (size_t i = 0; i < c->outputs.n; i++) {
-            acirc_eval_mpz_mod(rs[i], c, c->outputs.buf[i], xs, ys, modulus);
+        test_ok = acirc_eval_mpz_ctx(ctx, rs, xs, ys) == ACIRC_OK;
+        for (size_t i = 0; i < c->outputs.n; i++)
             test_ok = test_ok && (mpz_cmp_ui(rs[i], tests->outs[test_num][i]) == 0);
-        }
 
         if (g_verbose) {
             if (!test_ok)
@@ -129,6 +281,15 @@ bool acirc_ensure_mpz(acirc *c)
 
         ok = ok && test_ok;
     }
+    acirc_mpz_ctx_free(ctx);
+    acirc_plan_free(plan);
+    for (size_t i = 0; i < c->ninputs; ++i)
+        mpz_clear(xs[i]);
+    for (size_t i = 0; i < c->consts.n; ++i)
+        mpz_clear(ys[i]);
+    for (size_t i = 0; i < c->outputs.n; ++i)
+        mpz_clear(rs[i]);
+    mpz_clear(modulus);
     return ok;
 }
 
@@ -0,0 +1,268 @@
+#include "lines.h"
+#include "utils.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Hand-written tokenizer for the acirc text format.  It accepts the same
+ * language as parse.y/scan.l, but works directly on a byte buffer. */
+
+void lines_init(lines_t *l)
+{
+    l->_args_alloc = 16;
+    l->args = acirc_calloc(l->_args_alloc, sizeof l->args[0]);
+    l->_buf_alloc = 256;
+    l->buf = acirc_calloc(l->_buf_alloc, sizeof l->buf[0]);
+    l->_strs_alloc = 16;
+    l->strs = acirc_calloc(l->_strs_alloc, sizeof l->strs[0]);
+    l->lineno = 0;
+    l->quiet = false;
+}
+
+void lines_clear(lines_t *l)
+{
+    free(l->args);
+    free(l->buf);
+    free(l->strs);
+}
+
+static inline bool is_space(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+static inline bool is_alpha(char ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+static inline bool is_digit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+static inline bool is_alnum(char ch)
+{
+    return is_alpha(ch) || is_digit(ch);
+}
+
+static inline const char * skip_space(const char *p, const char *end)
+{
+    while (p < end && is_space(*p))
+        p++;
+    return p;
+}
+
+/* a line ends at the newline or at the start of a comment */
+static inline bool at_eol(const char *p, const char *end)
+{
+    return p == end || *p == '#';
+}
+
+static int parse_dec(const char **pp, const char *end, acircref *out)
+{
+    const char *p = *pp;
+    acircref x = 0;
+    if (p == end || !is_digit(*p))
+        return ACIRC_ERR;
+    while (p < end && is_digit(*p)) {
+        const int d = *p++ - '0';
+        if (x > (ACIRC_REF_MAX - d) / 10)
+            return ACIRC_ERR;
+        x = x * 10 + d;
+    }
+    if (p < end && is_alnum(*p))
+        return ACIRC_ERR;
+    *pp = p;
+    *out = x;
+    return ACIRC_OK;
+}
+
+/* consts are written in base 36, as in strtol(s, NULL, 36), which saturates
+ * at LONG_MAX on overflow */
+static int parse_b36(const char **pp, const char *end, long *out)
+{
+    const char *p = *pp;
+    long x = 0;
+    if (p == end || !is_alnum(*p))
+        return ACIRC_ERR;
+    for (; p < end && is_alnum(*p); ++p) {
+        const char ch = *p;
+        const int d = is_digit(ch) ? ch - '0'
+            : (ch >= 'a' && ch <= 'z') ? ch - 'a' + 10
+            : ch - 'A' + 10;
+        x = x > (LONG_MAX - d) / 36 ? LONG_MAX : x * 36 + d;
+    }
+    *pp = p;
+    *out = x;
+    return ACIRC_OK;
+}
+
+static int parse_op(const char *tok, size_t len, acirc_operation *op)
+{
+    if (len != 3)
+        return ACIRC_ERR;
+    if (memcmp(tok, "ADD", 3) == 0)
+        *op = OP_ADD;
+    else if (memcmp(tok, "SUB", 3) == 0)
+        *op = OP_SUB;
+    else if (memcmp(tok, "MUL", 3) == 0)
+        *op = OP_MUL;
+    else if (memcmp(tok, "SET", 3) == 0)
+        *op = OP_SET;
+    else
+        return ACIRC_ERR;
+    return ACIRC_OK;
+}
+
+static int syntax_error(const lines_t *l)
+{
+    if (!l->quiet)
+        fprintf(stderr, "error: %lu: syntax error\n", l->lineno);
+    return ACIRC_ERR;
+}
+
+static int parse_command(lines_t *l, const char *p, const char *end,
+                         const acirc_callbacks_t *cbs, void *data)
+{
+    /* every token plus its terminator fits in the line length plus one */
+    const size_t need = (size_t) (end - p) + 2;
+    if (need > l->_buf_alloc) {
+        l->_buf_alloc = need;
+        l->buf = acirc_realloc(l->buf, l->_buf_alloc * sizeof l->buf[0]);
+    }
+    char *out = l->buf;
+    const char *name = out;
+    size_t n = 0;
+
+    *out++ = *p++;              /* ':' */
+    if (p == end || !is_alpha(*p))
+        return syntax_error(l);
+    while (p < end && is_alpha(*p))
+        *out++ = *p++;
+    *out++ = '\0';
+
+    for (;;) {
+        p = skip_space(p, end);
+        if (p == end)
+            break;
+        if (n == l->_strs_alloc) {
+            l->_strs_alloc *= 2;
+            l->strs = acirc_realloc(l->strs, l->_strs_alloc * sizeof l->strs[0]);
+        }
+        l->strs[n++] = out;
+        while (p < end && !is_space(*p))
+            *out++ = *p++;
+        *out++ = '\0';
+    }
+    return cbs->command ? cbs->command(data, name, l->strs, n) : ACIRC_OK;
+}
+
+static int parse_line(lines_t *l, const char *p, const char *end,
+                      const acirc_callbacks_t *cbs, void *data)
+{
+    acircref ref;
+    const char *tok;
+    size_t len;
+
+    p = skip_space(p, end);
+    if (at_eol(p, end))
+        return ACIRC_OK;
+    if (*p == ':')
+        return parse_command(l, p, end, cbs, data);
+
+    if (parse_dec(&p, end, &ref) == ACIRC_ERR)
+        return syntax_error(l);
+    p = skip_space(p, end);
+    tok = p;
+    while (p < end && is_alnum(*p))
+        p++;
+    len = p - tok;
+    p = skip_space(p, end);
+
+    if (len == 5 && memcmp(tok, "input", 5) == 0) {
+        acircref id;
+        if (parse_dec(&p, end, &id) == ACIRC_ERR)
+            return syntax_error(l);
+        if (!at_eol(skip_space(p, end), end))
+            return syntax_error(l);
+        return cbs->input ? cbs->input(data, ref, id) : ACIRC_OK;
+    } else if (len == 5 && memcmp(tok, "const", 5) == 0) {
+        long val;
+        if (parse_b36(&p, end, &val) == ACIRC_ERR)
+            return syntax_error(l);
+        if (!at_eol(skip_space(p, end), end))
+            return syntax_error(l);
+        /* narrowed to int as the bison parser does with strtol's result */
+        return cbs->constant ? cbs->constant(data, ref, (int) val) : ACIRC_OK;
+    } else {
+        acirc_operation op;
+        size_t nargs = 0;
+        if (parse_op(tok, len, &op) == ACIRC_ERR)
+            return syntax_error(l);
+        while (!at_eol(p, end)) {
+            if (nargs == l->_args_alloc) {
+                l->_args_alloc *= 2;
+                l->args = acirc_realloc(l->args, l->_args_alloc * sizeof l->args[0]);
+            }
+            if (parse_dec(&p, end, &l->args[nargs++]) == ACIRC_ERR)
+                return syntax_error(l);
+            p = skip_space(p, end);
+        }
+        return cbs->gate ? cbs->gate(data, ref, op, l->args, nargs) : ACIRC_OK;
+    }
+}
+
+int lines_parse(lines_t *l, const char *buf, size_t len,
+                const acirc_callbacks_t *cbs, void *data)
+{
+    const char *p = buf;
+    const char *const end = buf + len;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL)
+            eol = end;
+        l->lineno++;
+        if (parse_line(l, p, eol, cbs, data) != ACIRC_OK)
+            return ACIRC_ERR;
+        p = eol + 1;
+    }
+    return ACIRC_OK;
+}
+
+/* Reads fp in fixed-size blocks, handing every complete line to lines_parse.
+ * Only the current block (grown to fit the longest line) is kept in memory. */
+int lines_fparse(lines_t *l, FILE *fp, const acirc_callbacks_t *cbs, void *data)
+{
+    size_t alloc = 1 << 16, len = 0;
+    char *buf = acirc_malloc(alloc);
+    int ret;
+
+    for (;;) {
+        const size_t n = fread(buf + len, 1, alloc - len, fp);
+        size_t done;
+        if (n == 0) {
+            ret = ferror(fp) ? ACIRC_ERR : lines_parse(l, buf, len, cbs, data);
+            break;
+        }
+        len += n;
+        for (done = len; done > 0 && buf[done - 1] != '\n'; --done)
+            ;
+        if (done == 0) {
+            if (len == alloc) {
+                alloc *= 2;
+                buf = acirc_realloc(buf, alloc);
+            }
+            continue;
+        }
+        if ((ret = lines_parse(l, buf, done, cbs, data)) != ACIRC_OK)
+            break;
+        memmove(buf, buf + done, len - done);
+        len -= done;
+    }
+    free(buf);
+    return ret;
+}
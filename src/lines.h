@@ -0,0 +1,21 @@
+#pragma once
+
+#include "acirc.h"
+
+/* Scratch space reused across lines, so parsing does no per-token allocation */
+typedef struct {
+    acircref *args;
+    size_t _args_alloc;
+    char *buf;
+    size_t _buf_alloc;
+    const char **strs;
+    size_t _strs_alloc;
+    size_t lineno;
+    bool quiet;                 /* don't report syntax errors */
+} lines_t;
+
+void lines_init(lines_t *l);
+void lines_clear(lines_t *l);
+int lines_parse(lines_t *l, const char *buf, size_t len,
+                const acirc_callbacks_t *cbs, void *data);
+int lines_fparse(lines_t *l, FILE *fp, const acirc_callbacks_t *cbs, void *data);
@@ -0,0 +1,143 @@
+#include "acirc.h"
+#include "lines.h"
+#include "utils.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int fast_input(void *data, acircref ref, acircref id)
+{
+    return acirc_add_input(data, ref, id);
+}
+
+static int fast_const(void *data, acircref ref, int val)
+{
+    return acirc_add_const(data, ref, val);
+}
+
+static int fast_gate(void *data, acircref ref, acirc_operation op,
+                     const acircref *args, size_t nargs)
+{
+    return acirc_add_gate(data, ref, op, args, nargs);
+}
+
+static int fast_command(void *data, const char *name, const char **strs, size_t n)
+{
+    /* like the bison parser, a failing command is reported but not fatal */
+    (void) acirc_add_command(data, name, strs, n);
+    return ACIRC_OK;
+}
+
+static const acirc_callbacks_t fast_cbs = {
+    .input = fast_input,
+    .constant = fast_const,
+    .gate = fast_gate,
+    .command = fast_command,
+};
+
+static int read_buf(acirc *c, const char *buf, size_t len)
+{
+    lines_t l;
+    int ret;
+    lines_init(&l);
+    ret = lines_parse(&l, buf, len, &fast_cbs, c);
+    lines_clear(&l);
+    return ret;
+}
+
+static int read_stream(acirc *c, FILE *fp)
+{
+    lines_t l;
+    int ret;
+    lines_init(&l);
+    ret = lines_fparse(&l, fp, &fast_cbs, c);
+    lines_clear(&l);
+    return ret;
+}
+
+/* maps fd and parses from byte 'start' onward; returns 1 if fd cannot be mapped */
+static int read_fd(acirc *c, int fd, off_t start)
+{
+    struct stat st;
+    char *map;
+    int ret;
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || start < 0)
+        return 1;
+    if (st.st_size <= start)
+        return ACIRC_OK;
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return 1;
+    (void) madvise(map, st.st_size, MADV_SEQUENTIAL);
+    ret = read_buf(c, map + start, st.st_size - start);
+    munmap(map, st.st_size);
+    return ret;
+}
+
+static acirc * fast_result(acirc *c, bool mine, int ret)
+{
+    if (ret != ACIRC_OK) {
+        if (mine) {
+            acirc_clear(c);
+            free(c);
+        }
+        return NULL;
+    }
+    return c;
+}
+
+static acirc * fast_new(acirc *c, bool *mine)
+{
+    *mine = false;
+    if (c == NULL) {
+        c = acirc_calloc(1, sizeof c[0]);
+        acirc_init(c);
+        *mine = true;
+    }
+    return c;
+}
+
+acirc * acirc_fread_fast(acirc *c, FILE *fp)
+{
+    bool mine;
+    int ret;
+
+    c = fast_new(c, &mine);
+    ret = read_fd(c, fileno(fp), ftello(fp));
+    if (ret == 1)
+        ret = read_stream(c, fp);
+    else
+        (void) fseeko(fp, 0, SEEK_END);
+    return fast_result(c, mine, ret);
+}
+
+acirc * acirc_mmap_read(acirc *c, const char *fname)
+{
+    bool mine;
+    int fd, ret;
+
+    if ((fd = open(fname, O_RDONLY)) == -1) {
+        fprintf(stderr, "error: unable to open '%s'\n", fname);
+        return NULL;
+    }
+    c = fast_new(c, &mine);
+    ret = read_fd(c, fd, 0);
+    if (ret == 1) {
+        FILE *fp = fdopen(fd, "r");
+        if (fp == NULL) {
+            close(fd);
+            ret = ACIRC_ERR;
+        } else {
+            ret = read_stream(c, fp);
+            fclose(fp);
+        }
+    } else {
+        close(fd);
+    }
+    return fast_result(c, mine, ret);
+}
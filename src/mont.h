@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Montgomery arithmetic modulo an odd word-sized p < 2^62, with R = 2^64.
+ * Values are kept as x * R mod p, in [0, p), which turns every modular
+ * multiplication into two word multiplications and no division. */
+typedef struct {
+    uint64_t p;
+    uint64_t pinv;              /* -p^-1 mod 2^64 */
+    uint64_t one;               /* R mod p */
+    uint64_t r2;                /* R^2 mod p */
+} mont_t;
+
+__extension__ typedef unsigned __int128 mont_wide;
+
+static inline void mont_init(mont_t *m, uint64_t p)
+{
+    uint64_t inv = p;           /* correct to 3 bits, since p is odd */
+    for (int i = 0; i < 5; ++i)
+        inv *= 2 - p * inv;
+    m->p = p;
+    m->pinv = -inv;
+    m->one = (uint64_t) (((mont_wide) 1 << 64) % p);
+    m->r2 = (uint64_t) ((mont_wide) m->one * m->one % p);
+}
+
+/* a * b / R mod p, for a * b < p * R */
+static inline uint64_t mont_mul(uint64_t a, uint64_t b, uint64_t p, uint64_t pinv)
+{
+    const mont_wide t = (mont_wide) a * b;
+    const uint64_t q = (uint64_t) t * pinv;
+    const uint64_t r = (uint64_t) ((t + (mont_wide) q * p) >> 64);
+    return r >= p ? r - p : r;
+}
+
+static inline uint64_t mont_add(uint64_t a, uint64_t b, uint64_t p)
+{
+    const uint64_t r = a + b;
+    return r >= p ? r - p : r;
+}
+
+static inline uint64_t mont_sub(uint64_t a, uint64_t b, uint64_t p)
+{
+    return a >= b ? a - b : a + p - b;
+}
+
+/* x mod p into Montgomery form, and back */
+static inline uint64_t mont_to(const mont_t *m, uint64_t x)
+{
+    return mont_mul(x % m->p, m->r2, m->p, m->pinv);
+}
+
+static inline uint64_t mont_from(const mont_t *m, uint64_t x)
+{
+    return mont_mul(x, 1, m->p, m->pinv);
+}
@@ -0,0 +1,214 @@
+#include "acirc.h"
+
+#ifdef HAVE_GMP
+
+#include "plan.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Fixed-size evaluation for a modulus known up front.  Every value is exactly
+ * k limbs, where k is the size of the modulus, and all of them sit in one
+ * slab indexed by plan slot, so evaluation touches contiguous memory and
+ * never allocates.  Values are kept in [0, modulus).  For an odd modulus
+ * they are in Montgomery form, with R = B^k, and a product is reduced by k
+ * single-limb multiply-adds using the precomputed -modulus^-1 mod B.  Even
+ * moduli fall back to mpn_tdiv_qr. */
+
+struct acirc_mpn_ctx {
+    acirc_plan *p;
+    size_t k;                   /* limbs per value */
+    mpz_t modulus;
+    const mp_limb_t *m;         /* limbs of modulus */
+    bool mont;                  /* odd modulus: Montgomery form */
+    mp_limb_t minv;             /* -m^-1 mod B */
+    mp_limb_t *one;             /* 1, as stored */
+    mp_limb_t *r2;              /* R^2 mod m */
+    mp_limb_t *vals;            /* k limbs per slot */
+    mp_limb_t *tmp;             /* 2k limbs for products */
+    mp_limb_t *quot;            /* k + 1 limbs for mpn_tdiv_qr */
+    mpz_t red;                  /* inputs reduced mod m */
+};
+
+/* rp = tp / R mod m, for tp < m R of 2k limbs; clobbers tp */
+static void mpn_redc(const acirc_mpn_ctx *ctx, mp_limb_t *rp, mp_limb_t *tp)
+{
+    const size_t k = ctx->k;
+    mp_limb_t cy;
+
+    /* each step clears the low limb, whose slot then keeps the carry out of
+     * the top of that step */
+    for (size_t i = 0; i < k; ++i) {
+        const mp_limb_t q = tp[i] * ctx->minv;
+        tp[i] = mpn_addmul_1(tp + i, ctx->m, k, q);
+    }
+    cy = mpn_add_n(rp, tp + k, tp, k);
+    if (cy || mpn_cmp(rp, ctx->m, k) >= 0)
+        mpn_sub_n(rp, rp, ctx->m, k);
+}
+
+/* rp = ap * bp, reduced */
+static void mpn_mulmod(const acirc_mpn_ctx *ctx, mp_limb_t *rp,
+                       const mp_limb_t *ap, const mp_limb_t *bp)
+{
+    const size_t k = ctx->k;
+
+    if (ap == bp)
+        mpn_sqr(ctx->tmp, ap, k);
+    else
+        mpn_mul_n(ctx->tmp, ap, bp, k);
+    if (ctx->mont)
+        mpn_redc(ctx, rp, ctx->tmp);
+    else
+        mpn_tdiv_qr(ctx->quot, rp, 0, ctx->tmp, 2 * k, ctx->m, k);
+}
+
+static void mpn_addmod(const acirc_mpn_ctx *ctx, mp_limb_t *rp, const mp_limb_t *bp)
+{
+    if (mpn_add_n(rp, rp, bp, ctx->k) || mpn_cmp(rp, ctx->m, ctx->k) >= 0)
+        mpn_sub_n(rp, rp, ctx->m, ctx->k);
+}
+
+static void mpn_submod(const acirc_mpn_ctx *ctx, mp_limb_t *rp, const mp_limb_t *bp)
+{
+    if (mpn_sub_n(rp, rp, bp, ctx->k))
+        mpn_add_n(rp, rp, ctx->m, ctx->k);
+}
+
+/* reduces x and stores it in rp */
+static void mpn_load(acirc_mpn_ctx *ctx, mp_limb_t *rp, const mpz_t x)
+{
+    const size_t k = ctx->k;
+    size_t n;
+
+    mpz_mod(ctx->red, x, ctx->modulus);
+    n = mpz_size(ctx->red);
+    memcpy(rp, mpz_limbs_read(ctx->red), n * sizeof rp[0]);
+    memset(rp + n, '\0', (k - n) * sizeof rp[0]);
+    if (ctx->mont)
+        mpn_mulmod(ctx, rp, rp, ctx->r2);
+}
+
+static void mpn_store(acirc_mpn_ctx *ctx, mpz_t rop, const mp_limb_t *ap)
+{
+    const size_t k = ctx->k;
+    mp_limb_t *rp = mpz_limbs_write(rop, k);
+
+    if (ctx->mont) {
+        memcpy(ctx->tmp, ap, k * sizeof ap[0]);
+        memset(ctx->tmp + k, '\0', k * sizeof ap[0]);
+        mpn_redc(ctx, rp, ctx->tmp);
+    } else {
+        memcpy(rp, ap, k * sizeof ap[0]);
+    }
+    mpz_limbs_finish(rop, k);
+}
+
+acirc_mpn_ctx * acirc_mpn_ctx_new(acirc_plan *p, const mpz_t modulus)
+{
+    acirc_mpn_ctx *ctx;
+    const size_t k = mpz_size(modulus);
+    mpz_t r;
+
+    if (mpz_sgn(modulus) <= 0) {
+        fprintf(stderr, "error: modulus must be positive\n");
+        return NULL;
+    }
+    ctx = acirc_calloc(1, sizeof ctx[0]);
+    ctx->p = p;
+    ctx->k = k;
+    mpz_init_set(ctx->modulus, modulus);
+    ctx->m = mpz_limbs_read(ctx->modulus);
+    ctx->mont = mpz_odd_p(modulus) && mpz_cmp_ui(modulus, 1) > 0;
+    ctx->one = acirc_calloc(k, sizeof ctx->one[0]);
+    ctx->r2 = acirc_calloc(k, sizeof ctx->r2[0]);
+    ctx->vals = acirc_calloc((p->nslots + 1) * k, sizeof ctx->vals[0]);
+    ctx->tmp = acirc_calloc(2 * k, sizeof ctx->tmp[0]);
+    ctx->quot = acirc_calloc(k + 1, sizeof ctx->quot[0]);
+    mpz_init2(ctx->red, (k + 1) * GMP_NUMB_BITS);
+
+    mpz_init(r);
+    if (ctx->mont) {
+        mp_limb_t inv = ctx->m[0];  /* correct to 3 bits, since m is odd */
+        for (int i = 0; i < 6; ++i)
+            inv *= 2 - ctx->m[0] * inv;
+        ctx->minv = -inv;
+        mpz_setbit(r, 2 * k * GMP_NUMB_BITS);
+        mpz_mod(r, r, modulus);
+        mpz_export(ctx->r2, NULL, -1, sizeof ctx->r2[0], 0, 0, r);
+        mpz_set_ui(r, 0);
+        mpz_setbit(r, k * GMP_NUMB_BITS);
+    } else {
+        mpz_set_ui(r, 1);
+    }
+    mpz_mod(r, r, modulus);
+    mpz_export(ctx->one, NULL, -1, sizeof ctx->one[0], 0, 0, r);
+    mpz_clear(r);
+    return ctx;
+}
+
+void acirc_mpn_ctx_free(acirc_mpn_ctx *ctx)
+{
+    if (ctx == NULL)
+        return;
+    mpz_clears(ctx->modulus, ctx->red, NULL);
+    free(ctx->one);
+    free(ctx->r2);
+    free(ctx->vals);
+    free(ctx->tmp);
+    free(ctx->quot);
+    free(ctx);
+}
+
+int acirc_eval_mpn(acirc_mpn_ctx *ctx, mpz_t *rops, mpz_t *xs, mpz_t *ys)
+{
+    const acirc_plan *p = ctx->p;
+    const size_t k = ctx->k;
+    const acircref *args = p->args;
+    mp_limb_t *vals = ctx->vals;
+
+    for (size_t i = 0; i < p->n; ++i) {
+        mp_limb_t *rp = &vals[p->slots[i] * k];
+        const size_t n = p->nargs[i];
+        const acirc_operation op = p->ops[i];
+        switch (op) {
+        case OP_INPUT:
+            mpn_load(ctx, rp, xs[args[0]]);
+            break;
+        case OP_CONST:
+            mpn_load(ctx, rp, ys[args[0]]);
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_SET:
+            if (n == 0) {
+                if (op == OP_SUB || op == OP_SET)
+                    return ACIRC_ERR;
+                if (op == OP_MUL)
+                    memcpy(rp, ctx->one, k * sizeof rp[0]);
+                else
+                    memset(rp, '\0', k * sizeof rp[0]);
+                break;
+            }
+            memcpy(rp, &vals[args[0] * k], k * sizeof rp[0]);
+            for (size_t j = 1; j < n; ++j) {
+                const mp_limb_t *bp = &vals[args[j] * k];
+                if (op == OP_ADD)
+                    mpn_addmod(ctx, rp, bp);
+                else if (op == OP_SUB)
+                    mpn_submod(ctx, rp, bp);
+                else if (op == OP_MUL)
+                    mpn_mulmod(ctx, rp, rp, bp);
+            }
+            break;
+        default:
+            return ACIRC_ERR;
+        }
+        args += n;
+    }
+    for (size_t o = 0; o < p->noutputs; ++o)
+        mpn_store(ctx, rops[o], &vals[p->outputs[o] * k]);
+    return ACIRC_OK;
+}
+
+#endif
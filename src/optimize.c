@@ -0,0 +1,269 @@
+#include "acirc.h"
+#include "cse.h"
+#include "utils.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Rewrites a circuit into a fresh, densely numbered one, in three passes over
+ * a topological order:
+ *
+ *   1. forward SET gates to what they copy, fold gates whose arguments are
+ *      all constants into new constants, and merge gates and constants equal
+ *      to earlier ones;
+ *   2. walking back from the outputs, mark the refs still read by something;
+ *   3. emit the marked refs in order, so every argument precedes its reader.
+ *
+ * Inputs are always kept, so input ids and tests stay valid.  Secrets are
+ * kept as they are: they are neither forwarded nor folded. */
+
+enum {
+    OPT_PINNED = 1 << 0,        /* a secret */
+    OPT_CONST = 1 << 1,         /* value known, in vals */
+    OPT_LIVE = 1 << 2,
+};
+
+typedef struct {
+    acircref *fwd;              /* the ref each ref's readers should read */
+    long *vals;
+    uint8_t *flags;
+    acircref *map;              /* new ref of each live ref */
+    cse_t *cse;                 /* with ACIRC_OPT_CSE, aliases follow fwd */
+} opt_t;
+
+/* an ADD, SUB or MUL over constants, if the result still fits a constant */
+static bool opt_fold(const opt_t *o, const acirc_gate_t *gate, long *out)
+{
+    long val;
+
+    if (gate->op == OP_SUB && gate->nargs == 0)
+        return false;
+    for (size_t i = 0; i < gate->nargs; ++i)
+        if (!(o->flags[o->fwd[gate->args[i]]] & OPT_CONST))
+            return false;
+    val = gate->op == OP_MUL ? 1 : 0;
+    for (size_t i = 0; i < gate->nargs; ++i) {
+        const long x = o->vals[o->fwd[gate->args[i]]];
+        bool overflow;
+        if (gate->op == OP_ADD || (gate->op == OP_SUB && i == 0))
+            overflow = __builtin_add_overflow(val, x, &val);
+        else if (gate->op == OP_SUB)
+            overflow = __builtin_sub_overflow(val, x, &val);
+        else
+            overflow = __builtin_mul_overflow(val, x, &val);
+        if (overflow)
+            return false;
+    }
+    if (val < INT_MIN || val > INT_MAX)
+        return false;
+    *out = val;
+    return true;
+}
+
+/* points ref at an earlier equal constant or gate, if there is one */
+static void opt_cse(opt_t *o, const acirc_gate_t *gate, acircref ref)
+{
+    acircref prev = ref;
+
+    if ((o->flags[ref] & OPT_CONST) || gate->op == OP_CONST) {
+        const acircref val = (o->flags[ref] & OPT_CONST) ? o->vals[ref] : gate->args[1];
+        prev = cse_intern(o->cse, OP_CONST, &val, 1, ref);
+    } else if (gate->op == OP_ADD || gate->op == OP_SUB || gate->op == OP_MUL) {
+        prev = cse_intern(o->cse, gate->op, gate->args, gate->nargs, ref);
+    }
+    if (prev != ref)
+        o->fwd[ref] = prev;
+    if (o->fwd[ref] != ref)
+        cse_alias(o->cse, ref, o->fwd[ref]);
+}
+
+static void opt_forward(opt_t *o, const acirc *c, const acircref *topo,
+                        size_t n, uint32_t flags)
+{
+    for (size_t i = 0; i < n; ++i) {
+        const acircref ref = topo[i];
+        const acirc_gate_t gate = acirc_gate(c, ref);
+        o->fwd[ref] = ref;
+        if (o->flags[ref] & OPT_PINNED)
+            continue;
+        switch (gate.op) {
+        case OP_INPUT:
+            break;
+        case OP_CONST:
+            if (flags & ACIRC_OPT_FOLD) {
+                o->flags[ref] |= OPT_CONST;
+                o->vals[ref] = gate.args[1];
+            }
+            break;
+        case OP_SET:
+            if (flags & ACIRC_OPT_SET) {
+                o->fwd[ref] = o->fwd[gate.args[0]];
+            } else if (o->flags[o->fwd[gate.args[0]]] & OPT_CONST) {
+                o->flags[ref] |= OPT_CONST;
+                o->vals[ref] = o->vals[o->fwd[gate.args[0]]];
+            }
+            break;
+        default:
+            if ((flags & ACIRC_OPT_FOLD) && opt_fold(o, &gate, &o->vals[ref]))
+                o->flags[ref] |= OPT_CONST;
+            break;
+        }
+        if (o->cse)
+            opt_cse(o, &gate, ref);
+    }
+}
+
+static void opt_mark(opt_t *o, const acirc *c, const acircref *topo, size_t n)
+{
+    for (size_t i = n; i-- > 0;) {
+        const acircref ref = topo[i];
+        const acirc_gate_t gate = acirc_gate(c, ref);
+        if (!(o->flags[ref] & OPT_LIVE) || (o->flags[ref] & OPT_CONST))
+            continue;
+        switch (gate.op) {
+        case OP_INPUT: case OP_CONST:
+            break;
+        case OP_SET:
+            o->flags[o->fwd[gate.args[0]]] |= OPT_LIVE;
+            break;
+        default:
+            for (size_t j = 0; j < gate.nargs; ++j)
+                o->flags[o->fwd[gate.args[j]]] |= OPT_LIVE;
+            break;
+        }
+    }
+}
+
+static void opt_emit(opt_t *o, acirc *out, const acirc *c, const acircref *topo,
+                     size_t n)
+{
+    acircref *args = NULL;
+    size_t _args_alloc = 0;
+    acircref next = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        const acircref ref = topo[i];
+        const acirc_gate_t gate = acirc_gate(c, ref);
+        if (!(o->flags[ref] & OPT_LIVE))
+            continue;
+        o->map[ref] = next;
+        if (o->flags[ref] & OPT_CONST) {
+            acirc_add_const(out, next++, (int) o->vals[ref]);
+            continue;
+        }
+        switch (gate.op) {
+        case OP_INPUT:
+            acirc_add_input(out, next++, gate.args[0]);
+            break;
+        case OP_CONST:
+            acirc_add_const(out, next++, gate.args[1]);
+            break;
+        default: {
+            const size_t nargs = gate.op == OP_SET ? 1 : gate.nargs;
+            if (nargs > _args_alloc) {
+                _args_alloc = nargs;
+                args = acirc_realloc(args, _args_alloc * sizeof args[0]);
+            }
+            for (size_t j = 0; j < nargs; ++j)
+                args[j] = o->map[o->fwd[gate.args[j]]];
+            acirc_add_gate(out, next++, gate.op, args, nargs);
+            break;
+        }
+        }
+    }
+    free(args);
+}
+
+static void opt_copy_tests(acirc *out, const acirc *c)
+{
+    acirc_tests_t *t = &out->tests;
+    t->n = c->tests.n;
+    t->inps = acirc_calloc(t->n + 1, sizeof t->inps[0]);
+    t->outs = acirc_calloc(t->n + 1, sizeof t->outs[0]);
+    for (size_t i = 0; i < t->n; ++i) {
+        t->inps[i] = acirc_arena_calloc(&out->arena, c->ninputs, sizeof t->inps[i][0]);
+        t->outs[i] = acirc_arena_calloc(&out->arena, c->outputs.n, sizeof t->outs[i][0]);
+        memcpy(t->inps[i], c->tests.inps[i], c->ninputs * sizeof t->inps[i][0]);
+        memcpy(t->outs[i], c->tests.outs[i], c->outputs.n * sizeof t->outs[i][0]);
+    }
+}
+
+acirc * acirc_optimize(const acirc *c, uint32_t flags)
+{
+    const size_t nrefs = acirc_nrefs(c);
+    const size_t nroots = (flags & ACIRC_OPT_DCE)
+        ? c->ninputs + c->outputs.n + c->secrets.n : nrefs;
+    acircref *roots = acirc_calloc(nroots + 1, sizeof roots[0]);
+    acircref *topo = acirc_calloc(nrefs + 1, sizeof topo[0]);
+    opt_t o;
+    acirc *out;
+    size_t n, r = 0;
+
+    for (size_t ref = 0; ref < nrefs; ++ref) {
+        if (acirc_op(c, ref) == OP_EXTERNAL) {
+            fprintf(stderr, "error: external gates cannot be optimized\n");
+            goto error;
+        }
+    }
+    for (size_t i = 0; i < c->secrets.n; ++i) {
+        if (c->secrets.list[i] < 0 || (size_t) c->secrets.list[i] >= nrefs) {
+            fprintf(stderr, "error: secret %ld is not a wire\n", (long) c->secrets.list[i]);
+            goto error;
+        }
+    }
+
+    o.fwd = acirc_calloc(nrefs + 1, sizeof o.fwd[0]);
+    o.vals = acirc_calloc(nrefs + 1, sizeof o.vals[0]);
+    o.flags = acirc_calloc(nrefs + 1, sizeof o.flags[0]);
+    o.map = acirc_calloc(nrefs + 1, sizeof o.map[0]);
+    o.cse = (flags & ACIRC_OPT_CSE) ? cse_new() : NULL;
+
+    /* with DCE the inputs go first, so they keep the lowest refs */
+    for (size_t ref = 0; ref < nrefs; ++ref)
+        if (!(flags & ACIRC_OPT_DCE) || acirc_op(c, ref) == OP_INPUT)
+            roots[r++] = ref;
+    if (flags & ACIRC_OPT_DCE) {
+        for (size_t i = 0; i < c->outputs.n; ++i)
+            roots[r++] = c->outputs.buf[i];
+        for (size_t i = 0; i < c->secrets.n; ++i)
+            roots[r++] = c->secrets.list[i];
+    }
+    n = topological_order_roots(topo, c, roots, nroots);
+
+    for (size_t i = 0; i < c->secrets.n; ++i)
+        o.flags[c->secrets.list[i]] |= OPT_PINNED | OPT_LIVE;
+    opt_forward(&o, c, topo, n, flags);
+    /* without DCE every root is kept, and with it just the inputs */
+    for (size_t i = 0; i < ((flags & ACIRC_OPT_DCE) ? c->ninputs : nroots); ++i)
+        o.flags[roots[i]] |= OPT_LIVE;
+    for (size_t i = 0; i < c->outputs.n; ++i)
+        o.flags[o.fwd[c->outputs.buf[i]]] |= OPT_LIVE;
+    opt_mark(&o, c, topo, n);
+
+    out = acirc_calloc(1, sizeof out[0]);
+    acirc_init(out);
+    opt_emit(&o, out, c, topo, n);
+    for (size_t i = 0; i < c->outputs.n; ++i)
+        acirc_add_output(out, o.map[o.fwd[c->outputs.buf[i]]]);
+    out->secrets.n = c->secrets.n;
+    out->secrets.list = acirc_arena_calloc(&out->arena, c->secrets.n, sizeof out->secrets.list[0]);
+    for (size_t i = 0; i < c->secrets.n; ++i)
+        out->secrets.list[i] = o.map[c->secrets.list[i]];
+    opt_copy_tests(out, c);
+
+    free(o.fwd);
+    free(o.vals);
+    free(o.flags);
+    free(o.map);
+    cse_free(o.cse);
+    free(roots);
+    free(topo);
+    return out;
+
+error:
+    free(roots);
+    free(topo);
+    return NULL;
+}
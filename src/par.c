@@ -0,0 +1,213 @@
+#include "plan.h"
+#include "pool.h"
+#include "utils.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Parallel evaluators.  Values are indexed by ref here, since the plan's slot
+ * reuse assumes sequential evaluation.
+ *
+ * Level-synchronous driver: the steps of a plan are grouped by level; within
+ * a level no step reads another, so the threads of the pool claim chunks of
+ * the level from a shared counter and meet at a barrier before moving on to
+ * the next level.  This suits cheap gates.  The dependency-driven driver for
+ * expensive gates is in dag.c. */
+
+typedef struct {
+    acirc_pool *pool;
+    acirc_plan *p;
+    atomic_size_t *next;        /* next unclaimed step of each level */
+    size_t chunk;               /* steps claimed at a time */
+    atomic_bool failed;
+    acirc_gate_fn fn;
+    void *data;
+} levels_t;
+
+static void levels_worker(void *vargs, size_t tid)
+{
+    levels_t *lv = vargs;
+    const acirc_plan *p = lv->p;
+    (void) tid;
+
+    for (size_t k = 0; k < p->nlevels; ++k) {
+        const size_t lo = p->level_offsets[k], hi = p->level_offsets[k + 1];
+        for (;;) {
+            const size_t i = lo + atomic_fetch_add(&lv->next[k], lv->chunk);
+            if (i >= hi)
+                break;
+            const size_t end = i + lv->chunk < hi ? i + lv->chunk : hi;
+            for (size_t j = i; j < end; ++j) {
+                if (lv->fn(lv->data, p->refs[p->level_steps[j]]) != ACIRC_OK)
+                    atomic_store(&lv->failed, true);
+            }
+        }
+        pool_barrier(lv->pool);
+    }
+}
+
+static int eval_levels(acirc_pool *pool, acirc_plan *p, size_t chunk,
+                       acirc_gate_fn fn, void *data)
+{
+    levels_t lv;
+
+    plan_levels(p);
+    lv.pool = pool;
+    lv.p = p;
+    lv.chunk = chunk;
+    lv.fn = fn;
+    lv.data = data;
+    atomic_init(&lv.failed, false);
+    lv.next = acirc_calloc(p->nlevels + 1, sizeof lv.next[0]);
+    for (size_t k = 0; k < p->nlevels; ++k)
+        atomic_init(&lv.next[k], 0);
+    pool_run(pool, levels_worker, &lv);
+    free(lv.next);
+    return atomic_load(&lv.failed) ? ACIRC_ERR : ACIRC_OK;
+}
+
+typedef struct {
+    const acirc *c;
+    const int *xs;
+    int *vals;
+} par_int_t;
+
+static int par_int_gate(void *vargs, acircref ref)
+{
+    par_int_t *job = vargs;
+    const acirc *c = job->c;
+    const acirc_gate_t gate = acirc_gate(c, ref);
+    int *vals = job->vals;
+    int val;
+
+    switch (gate.op) {
+    case OP_INPUT:
+        val = job->xs[gate.args[0]];
+        break;
+    case OP_CONST:
+        val = gate.args[1];
+        break;
+    case OP_ADD:
+        val = 0;
+        for (size_t j = 0; j < gate.nargs; ++j)
+            val += vals[gate.args[j]];
+        break;
+    case OP_SUB:
+        val = vals[gate.args[0]];
+        for (size_t j = 1; j < gate.nargs; ++j)
+            val -= vals[gate.args[j]];
+        break;
+    case OP_MUL:
+        val = 1;
+        for (size_t j = 0; j < gate.nargs; ++j)
+            val *= vals[gate.args[j]];
+        break;
+    case OP_SET:
+        val = vals[gate.args[0]];
+        break;
+    case OP_EXTERNAL:
+        if ((val = acirc_eval_extgate(&c->extgates, &gate)) == -1)
+            return ACIRC_ERR;
+        break;
+    default:
+        return ACIRC_ERR;
+    }
+    vals[ref] = val;
+    return ACIRC_OK;
+}
+
+int acirc_eval_par(acirc_pool *pool, acirc_plan *p, const int *xs, int *ys)
+{
+    par_int_t job;
+    const acirc *c = p->c;
+    int ret;
+
+    job.c = c;
+    job.xs = xs;
+    job.vals = acirc_calloc(acirc_nrefs(c) + 1, sizeof job.vals[0]);
+    ret = eval_levels(pool, p, 256, par_int_gate, &job);
+    for (size_t i = 0; i < p->noutputs; ++i)
+        ys[i] = job.vals[c->outputs.buf[i]];
+    free(job.vals);
+    return ret;
+}
+
+#ifdef HAVE_GMP
+
+typedef struct {
+    const acirc *c;
+    mpz_t *xs;
+    mpz_t *ys;
+    mpz_srcptr modulus;
+    mpz_t *cache;
+} par_mpz_t;
+
+static int par_mpz_gate(void *vargs, acircref ref)
+{
+    par_mpz_t *job = vargs;
+    const acirc *c = job->c;
+    const acirc_gate_t gate = acirc_gate(c, ref);
+    mpz_t *cache = job->cache;
+    mpz_ptr rop = cache[ref];
+
+    switch (gate.op) {
+    case OP_INPUT:
+        mpz_set(rop, job->xs[gate.args[0]]);
+        break;
+    case OP_CONST:
+        mpz_set(rop, job->ys[gate.args[0]]);
+        break;
+    case OP_ADD:
+        mpz_set_ui(rop, 0);
+        for (size_t j = 0; j < gate.nargs; ++j)
+            mpz_add(rop, rop, cache[gate.args[j]]);
+        mpz_mod(rop, rop, job->modulus);
+        break;
+    case OP_SUB:
+        mpz_set(rop, cache[gate.args[0]]);
+        for (size_t j = 1; j < gate.nargs; ++j)
+            mpz_sub(rop, rop, cache[gate.args[j]]);
+        mpz_mod(rop, rop, job->modulus);
+        break;
+    case OP_MUL:
+        mpz_set_ui(rop, 1);
+        for (size_t j = 0; j < gate.nargs; ++j) {
+            mpz_mul(rop, rop, cache[gate.args[j]]);
+            mpz_mod(rop, rop, job->modulus);
+        }
+        break;
+    case OP_SET:
+        mpz_set(rop, cache[gate.args[0]]);
+        break;
+    default:
+        return ACIRC_ERR;
+    }
+    return ACIRC_OK;
+}
+
+int acirc_eval_mpz_mod_par(acirc_pool *pool, acirc_plan *p, mpz_t *rops,
+                           mpz_t *xs, mpz_t *ys, const mpz_t modulus)
+{
+    par_mpz_t job;
+    const acirc *c = p->c;
+    int ret;
+
+    job.c = c;
+    job.xs = xs;
+    job.ys = ys;
+    job.modulus = modulus;
+    job.cache = acirc_calloc(acirc_nrefs(c) + 1, sizeof job.cache[0]);
+    for (size_t i = 0; i < p->n; ++i)
+        mpz_init(job.cache[p->refs[i]]);
+    /* gates are expensive and levels uneven, so schedule by dependencies */
+    ret = acirc_eval_dag(pool, p, par_mpz_gate, &job);
+    for (size_t i = 0; i < p->noutputs; ++i)
+        mpz_set(rops[i], job.cache[c->outputs.buf[i]]);
+    for (size_t i = 0; i < p->n; ++i)
+        mpz_clear(job.cache[p->refs[i]]);
+    free(job.cache);
+    return ret;
+}
+
+#endif
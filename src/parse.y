@@ -1,5 +1,13 @@
-/* %define api.pure */
-%code requires { #include "acirc.h" }
+%define api.pure
+%code requires {
+#include "acirc.h"
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+}
+%lex-param { yyscan_t scanner }
+%parse-param { yyscan_t scanner }
 %parse-param { acirc *c }
 /* below not available on bison 2.7 */
 /* %define parse.error verbose */
@@ -8,22 +16,11 @@
 
 %{
 #include "acirc.h"
+#include "utils.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-extern int yylineno;
-extern int yylex(void);
-void yyerror(const acirc *c, const char *m);
-
-void yyerror(const acirc *c, const char *m)
-{
-    (void) c;
-    fprintf(stderr, "error: %d: %s\n", yylineno, m);
-}
-
-#define YYINITDEPTH 500000
-
 struct ll_node {
     struct ll_node *next;
     char *data;
@@ -47,6 +44,23 @@ struct ll {
     struct ll *ll;
 };
 
+%code {
+extern int yylex(YYSTYPE *lvalp, yyscan_t scanner);
+extern int yyget_lineno(yyscan_t scanner);
+extern acirc_arena_t *yyget_extra(yyscan_t scanner);
+
+/* per-line scratch space, shared with the scanner */
+#define SCRATCH (yyget_extra(scanner))
+
+void yyerror(yyscan_t scanner, const acirc *c, const char *m);
+
+void yyerror(yyscan_t scanner, const acirc *c, const char *m)
+{
+    (void) c;
+    fprintf(stderr, "error: %d: %s\n", yyget_lineno(scanner), m);
+}
+}
+
 %token ENDL
 %token INPUT CONST
 %token  <str>           COMMAND
@@ -61,60 +75,66 @@ struct ll {
 %%
 
 prog:
-        |       line prog
+        |       prog line
+                {
+                    /* every token of the line has been consumed, and the
+                     * parser has not read ahead into the next line */
+                    acirc_arena_reset(SCRATCH);
+                }
                 ;
 
-line:           command | input | const | gate
+line:           command | input | const | gate | ENDL
                 ;
 
-command:        COMMAND strlist ENDLS
+command:        COMMAND strlist ENDL
                 {
                     struct ll *list = $2;
                     struct ll_node *node = list->start;
-                    char *strs[list->length];
+                    const char **strs = acirc_arena_alloc(SCRATCH, list->length * sizeof strs[0]);
                     for (size_t i = 0; i < list->length; ++i) {
-                        struct ll_node *tmp;
                         strs[i] = node->data;
-                        tmp = node->next;
-                        free(node);
-                        node = tmp;
+                        node = node->next;
                     }
                     (void) acirc_add_command(c, $1, strs, list->length);
-                    for (size_t i = 0; i < list->length; ++i) {
-                        free(strs[i]);
-                    }
-                    free(list);
-                    free($1);
                 }
                 ;
 
 
-input:          STR INPUT STR ENDLS
+input:          STR INPUT STR ENDL
                 {
-                    acirc_add_input(c, strtol($1, NULL, 10), strtol($3, NULL, 10));
-                    free($1);
-                    free($3);
+                    acircref ref, id;
+                    if (str2ref($1, &ref) == ACIRC_ERR || str2ref($3, &id) == ACIRC_ERR) {
+                        yyerror(scanner, c, "reference out of range");
+                        YYABORT;
+                    }
+                    acirc_add_input(c, ref, id);
                 }
                 ;
 
-const:          STR CONST STR ENDLS
+const:          STR CONST STR ENDL
                 {
-                    acirc_add_const(c, strtol($1, NULL, 10), strtol($3, NULL, 36));
-                    free($1);
-                    free($3);
+                    acircref ref;
+                    if (str2ref($1, &ref) == ACIRC_ERR) {
+                        yyerror(scanner, c, "reference out of range");
+                        YYABORT;
+                    }
+                    acirc_add_const(c, ref, strtol($3, NULL, 36));
                 }
         ;
 
 strlist:        /* empty */
                 {
-                    struct ll *list = calloc(1, sizeof list[0]);
+                    struct ll *list = acirc_arena_alloc(SCRATCH, sizeof list[0]);
+                    list->start = list->end = NULL;
+                    list->length = 0;
                     $$ = list;
                 }
         |       strlist STR
                 {
                     struct ll *list = $1;
-                    struct ll_node *node = calloc(1, sizeof node[0]);
+                    struct ll_node *node = acirc_arena_alloc(SCRATCH, sizeof node[0]);
                     node->data = $2;
+                    node->next = NULL;
                     if (list->start == NULL) {
                         list->start = node;
                         list->end = node;
@@ -130,15 +150,17 @@ strlist:        /* empty */
 
 numlist:       /* empty */
                 {
-                    struct ll *list = calloc(1, sizeof list[0]);
+                    struct ll *list = acirc_arena_alloc(SCRATCH, sizeof list[0]);
                     list->start = list->end = NULL;
+                    list->length = 0;
                     $$ = list;
                 }
         |       numlist STR
                 {
                     struct ll *list = $1;
-                    struct ll_node *node = calloc(1, sizeof node[0]);
+                    struct ll_node *node = acirc_arena_alloc(SCRATCH, sizeof node[0]);
                     node->data = $2;
+                    node->next = NULL;
                     if (list->start == NULL) {
                         list->start = node;
                         list->end = node;
@@ -151,27 +173,25 @@ numlist:       /* empty */
                 }
                 ;
 
-gate:           STR GATE numlist ENDLS
+gate:           STR GATE numlist ENDL
                 {
                     struct ll *list = $3;
                     struct ll_node *node = list->start;
-                    acircref refs[list->length];
+                    acircref *refs = acirc_arena_alloc(SCRATCH, list->length * sizeof refs[0]);
+                    acircref ref;
                     for (size_t i = 0; i < list->length; ++i) {
-                        struct ll_node *tmp;
-                        refs[i] = atoi(node->data);
-                        tmp = node->next;
-                        free(node->data);
-                        free(node);
-                        node = tmp;
+                        if (str2ref(node->data, &refs[i]) == ACIRC_ERR) {
+                            yyerror(scanner, c, "reference out of range");
+                            YYABORT;
+                        }
+                        node = node->next;
                     }
-                    acirc_add_gate(c, atoi($1), $2, refs, list->length);
-                    free(list);
-                    free($1);
+                    if (str2ref($1, &ref) == ACIRC_ERR) {
+                        yyerror(scanner, c, "reference out of range");
+                        YYABORT;
+                    }
+                    acirc_add_gate(c, ref, $2, refs, list->length);
                 }
                 ;
 
-ENDLS:          ENDLS ENDL
-        |       ENDL
-        ;
-
 %%
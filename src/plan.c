@@ -0,0 +1,594 @@
+#include "mont.h"
+#include "plan.h"
+#include "stats.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* number of lanes evaluated together by the batch evaluators */
+#define PLAN_LANES 256
+
+static void plan_slots(acirc_plan *p, const acircref *outputs)
+{
+    const size_t nrefs = acirc_nrefs(p->c);
+    size_t *step = acirc_calloc(nrefs + 1, sizeof step[0]);
+    size_t *last = acirc_calloc(p->n + 1, sizeof last[0]);
+    size_t *slot_of = acirc_calloc(nrefs + 1, sizeof slot_of[0]);
+    size_t *free_slots = acirc_calloc(p->n + 1, sizeof free_slots[0]);
+    size_t nfree = 0;
+    acircref *args = p->args;
+
+    /* the step at which each value is read for the last time */
+    for (size_t i = 0; i < p->n; ++i) {
+        step[p->refs[i]] = i;
+        last[i] = i;
+    }
+    for (size_t i = 0; i < p->n; ++i) {
+        switch (p->ops[i]) {
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_SET:
+            for (size_t j = 0; j < p->nargs[i]; ++j)
+                last[step[args[j]]] = i;
+            break;
+        }
+        args += p->nargs[i];
+    }
+    for (size_t i = 0; i < p->noutputs; ++i)
+        last[step[outputs[i]]] = SIZE_MAX;
+
+    /* the result's slot is taken before the arguments' slots are released,
+     * so a gate never overwrites an argument it is still reading */
+    args = p->args;
+    for (size_t i = 0; i < p->n; ++i) {
+        const size_t slot = nfree ? free_slots[--nfree] : p->nslots++;
+        p->slots[i] = slot;
+        slot_of[p->refs[i]] = slot;
+        switch (p->ops[i]) {
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_SET:
+            for (size_t j = 0; j < p->nargs[i]; ++j) {
+                const size_t s = step[args[j]];
+                args[j] = slot_of[args[j]];
+                if (last[s] == i) {
+                    free_slots[nfree++] = p->slots[s];
+                    last[s] = SIZE_MAX;
+                }
+            }
+            break;
+        }
+        if (last[i] == i)       /* never read */
+            free_slots[nfree++] = slot;
+        args += p->nargs[i];
+    }
+    for (size_t i = 0; i < p->noutputs; ++i)
+        p->outputs[i] = slot_of[outputs[i]];
+
+    free(step);
+    free(last);
+    free(slot_of);
+    free(free_slots);
+}
+
+acirc_plan * acirc_plan_new(const acirc *c)
+{
+    acirc_plan *p = acirc_calloc(1, sizeof p[0]);
+    const size_t nrefs = acirc_nrefs(c);
+    const acircref *order;
+    size_t nargs = 0;
+
+    p->c = c;
+    p->noutputs = c->outputs.n;
+    p->refs = acirc_calloc(nrefs + 1, sizeof p->refs[0]);
+    if ((order = stats_order(c, &p->n)) != NULL)
+        memcpy(p->refs, order, p->n * sizeof p->refs[0]);
+    else
+        p->n = topological_order_roots(p->refs, c, c->outputs.buf, c->outputs.n);
+
+    p->ops = acirc_calloc(p->n + 1, sizeof p->ops[0]);
+    p->nargs = acirc_calloc(p->n + 1, sizeof p->nargs[0]);
+    for (size_t i = 0; i < p->n; ++i) {
+        p->ops[i] = acirc_op(c, p->refs[i]);
+        p->nargs[i] = acirc_nargs(c, p->refs[i]);
+        nargs += p->nargs[i];
+    }
+    p->args = acirc_calloc(nargs + 1, sizeof p->args[0]);
+    nargs = 0;
+    for (size_t i = 0; i < p->n; ++i) {
+        memcpy(&p->args[nargs], acirc_args(c, p->refs[i]), p->nargs[i] * sizeof p->args[0]);
+        nargs += p->nargs[i];
+    }
+    p->slots = acirc_calloc(p->n + 1, sizeof p->slots[0]);
+    p->outputs = acirc_calloc(p->noutputs + 1, sizeof p->outputs[0]);
+    plan_slots(p, c->outputs.buf);
+    p->vals = acirc_calloc(p->nslots + 1, sizeof p->vals[0]);
+    return p;
+}
+
+void acirc_plan_free(acirc_plan *p)
+{
+    if (p) {
+        free(p->refs);
+        free(p->ops);
+        free(p->nargs);
+        free(p->args);
+        free(p->slots);
+        free(p->outputs);
+        free(p->vals);
+        free(p->level_offsets);
+        free(p->level_steps);
+        free(p->npreds);
+        free(p->succ_offsets);
+        free(p->succs);
+        free(p);
+    }
+}
+
+/* level of a step is one more than the highest level among its arguments;
+ * steps are bucketed by level, keeping plan order within a level */
+void plan_levels(acirc_plan *p)
+{
+    const acirc *c = p->c;
+    const acirc_stats_cache *s = c->stats;
+    const acircref *order;
+    size_t *level, *pos, n;
+
+    if (p->level_offsets)
+        return;
+    /* the cached schedule indexes the cached order, so it only fits a plan
+     * built from that same order */
+    order = stats_order(c, &n);
+    if (order != NULL && n == p->n && memcmp(p->refs, order, n * sizeof order[0]) == 0) {
+        p->nlevels = s->nlevels;
+        p->level_offsets = acirc_calloc(p->nlevels + 1, sizeof p->level_offsets[0]);
+        p->level_steps = acirc_calloc(p->n + 1, sizeof p->level_steps[0]);
+        memcpy(p->level_offsets, s->level_offsets, (p->nlevels + 1) * sizeof p->level_offsets[0]);
+        memcpy(p->level_steps, s->level_steps, p->n * sizeof p->level_steps[0]);
+        return;
+    }
+    level = acirc_calloc(acirc_nrefs(c) + 1, sizeof level[0]);
+    p->nlevels = 0;
+    for (size_t i = 0; i < p->n; ++i) {
+        const acircref ref = p->refs[i];
+        const acircref *args = acirc_args(c, ref);
+        size_t lvl = 0;
+        switch (p->ops[i]) {
+        case OP_INPUT: case OP_CONST:
+            break;
+        default:
+            for (size_t j = 0; j < p->nargs[i]; ++j)
+                if (level[args[j]] + 1 > lvl)
+                    lvl = level[args[j]] + 1;
+            break;
+        }
+        level[ref] = lvl;
+        if (lvl + 1 > p->nlevels)
+            p->nlevels = lvl + 1;
+    }
+    p->level_offsets = acirc_calloc(p->nlevels + 1, sizeof p->level_offsets[0]);
+    p->level_steps = acirc_calloc(p->n + 1, sizeof p->level_steps[0]);
+    for (size_t i = 0; i < p->n; ++i)
+        p->level_offsets[level[p->refs[i]] + 1]++;
+    for (size_t k = 0; k < p->nlevels; ++k)
+        p->level_offsets[k + 1] += p->level_offsets[k];
+    pos = acirc_calloc(p->nlevels + 1, sizeof pos[0]);
+    memcpy(pos, p->level_offsets, p->nlevels * sizeof pos[0]);
+    for (size_t i = 0; i < p->n; ++i)
+        p->level_steps[pos[level[p->refs[i]]]++] = i;
+    free(pos);
+    free(level);
+}
+
+/* edges run from each argument's step to the reading step, once per
+ * argument, as in the fan-out index */
+void plan_dag(acirc_plan *p)
+{
+    const acirc *c = p->c;
+    size_t *step, *pos;
+
+    if (p->npreds)
+        return;
+    step = acirc_calloc(acirc_nrefs(c) + 1, sizeof step[0]);
+    for (size_t i = 0; i < p->n; ++i)
+        step[p->refs[i]] = i;
+    p->npreds = acirc_calloc(p->n + 1, sizeof p->npreds[0]);
+    p->succ_offsets = acirc_calloc(p->n + 1, sizeof p->succ_offsets[0]);
+    for (size_t i = 0; i < p->n; ++i) {
+        const acircref *args = acirc_args(c, p->refs[i]);
+        if (p->ops[i] == OP_INPUT || p->ops[i] == OP_CONST)
+            continue;
+        p->npreds[i] = p->nargs[i];
+        for (size_t j = 0; j < p->nargs[i]; ++j)
+            p->succ_offsets[step[args[j]] + 1]++;
+    }
+    for (size_t i = 0; i < p->n; ++i)
+        p->succ_offsets[i + 1] += p->succ_offsets[i];
+    p->succs = acirc_calloc(p->succ_offsets[p->n] + 1, sizeof p->succs[0]);
+    pos = acirc_calloc(p->n + 1, sizeof pos[0]);
+    memcpy(pos, p->succ_offsets, p->n * sizeof pos[0]);
+    for (size_t i = 0; i < p->n; ++i) {
+        const acircref *args = acirc_args(c, p->refs[i]);
+        if (p->ops[i] == OP_INPUT || p->ops[i] == OP_CONST)
+            continue;
+        for (size_t j = 0; j < p->nargs[i]; ++j)
+            p->succs[pos[step[args[j]]]++] = i;
+    }
+    free(pos);
+    free(step);
+}
+
+static int plan_extgate(const acirc_plan *p, size_t i)
+{
+    const acirc_gate_t gate = acirc_gate(p->c, p->refs[i]);
+    return acirc_eval_extgate(&p->c->extgates, &gate);
+}
+
+int acirc_eval_all(acirc_plan *p, const int *xs, int *ys)
+{
+    int *vals = p->vals;
+    const acircref *args = p->args;
+
+    for (size_t i = 0; i < p->n; ++i) {
+        const size_t n = p->nargs[i];
+        int val;
+        switch (p->ops[i]) {
+        case OP_INPUT:
+            val = xs[args[0]];
+            break;
+        case OP_CONST:
+            val = args[1];
+            break;
+        case OP_ADD:
+            val = 0;
+            for (size_t j = 0; j < n; ++j)
+                val += vals[args[j]];
+            break;
+        case OP_SUB:
+            val = vals[args[0]];
+            for (size_t j = 1; j < n; ++j)
+                val -= vals[args[j]];
+            break;
+        case OP_MUL:
+            val = 1;
+            for (size_t j = 0; j < n; ++j)
+                val *= vals[args[j]];
+            break;
+        case OP_SET:
+            val = vals[args[0]];
+            break;
+        case OP_EXTERNAL:
+            if ((val = plan_extgate(p, i)) == -1)
+                return ACIRC_ERR;
+            break;
+        default:
+            return ACIRC_ERR;
+        }
+        vals[p->slots[i]] = val;
+        args += n;
+    }
+    for (size_t i = 0; i < p->noutputs; ++i)
+        ys[i] = vals[p->outputs[i]];
+    return ACIRC_OK;
+}
+
+/* Batch evaluation.  Each slot holds a block of lanes, and every gate is a
+ * handful of loops over that block with no dependencies between iterations,
+ * which the compiler turns into SIMD code.  Arithmetic is done unsigned so
+ * that overflow wraps instead of being undefined. */
+
+static void batch_block(const acirc_plan *p, unsigned *vals, const int *xs,
+                        size_t stride, size_t w, const int *ext)
+{
+    const acircref *args = p->args;
+
+    for (size_t i = 0; i < p->n; ++i) {
+        unsigned *restrict dst = &vals[p->slots[i] * PLAN_LANES];
+        const size_t n = p->nargs[i];
+        switch (p->ops[i]) {
+        case OP_INPUT: {
+            const int *x = &xs[args[0] * stride];
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = x[l];
+            break;
+        }
+        case OP_CONST:
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = args[1];
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_SET: {
+            if (n == 0) {
+                const unsigned unit = p->ops[i] == OP_MUL;
+                for (size_t l = 0; l < w; ++l)
+                    dst[l] = unit;
+                break;
+            }
+            const unsigned *a = &vals[args[0] * PLAN_LANES];
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = a[l];
+            for (size_t j = 1; j < n; ++j) {
+                const unsigned *b = &vals[args[j] * PLAN_LANES];
+                if (p->ops[i] == OP_ADD)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] += b[l];
+                else if (p->ops[i] == OP_SUB)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] -= b[l];
+                else if (p->ops[i] == OP_MUL)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] *= b[l];
+            }
+            break;
+        }
+        case OP_EXTERNAL:
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = ext[i];
+            break;
+        }
+        args += n;
+    }
+}
+
+/* SUB and SET need at least one argument */
+static int batch_check(const acirc_plan *p)
+{
+    for (size_t i = 0; i < p->n; ++i) {
+        if ((p->ops[i] == OP_SUB || p->ops[i] == OP_SET) && p->nargs[i] == 0)
+            return ACIRC_ERR;
+    }
+    return ACIRC_OK;
+}
+
+/* external gates don't depend on the inputs, so they are evaluated once per
+ * batch */
+static int * batch_externals(const acirc_plan *p, bool *ok)
+{
+    int *ext = NULL;
+    *ok = true;
+    for (size_t i = 0; i < p->n; ++i) {
+        if (p->ops[i] != OP_EXTERNAL)
+            continue;
+        if (ext == NULL)
+            ext = acirc_calloc(p->n, sizeof ext[0]);
+        if ((ext[i] = plan_extgate(p, i)) == -1)
+            *ok = false;
+    }
+    return ext;
+}
+
+int acirc_eval_batch(acirc_plan *p, const int *xs, int *ys, size_t nlanes)
+{
+    unsigned *vals;
+    int *ext;
+    bool ok;
+
+    if (batch_check(p) == ACIRC_ERR)
+        return ACIRC_ERR;
+    ext = batch_externals(p, &ok);
+    if (!ok) {
+        free(ext);
+        return ACIRC_ERR;
+    }
+    vals = acirc_calloc((p->nslots + 1) * PLAN_LANES, sizeof vals[0]);
+    for (size_t start = 0; start < nlanes; start += PLAN_LANES) {
+        const size_t w = nlanes - start < PLAN_LANES ? nlanes - start : PLAN_LANES;
+        batch_block(p, vals, xs + start, nlanes, w, ext);
+        for (size_t o = 0; o < p->noutputs; ++o) {
+            const unsigned *v = &vals[p->outputs[o] * PLAN_LANES];
+            int *y = &ys[o * nlanes + start];
+            for (size_t l = 0; l < w; ++l)
+                y[l] = (int) v[l];
+        }
+    }
+    free(vals);
+    free(ext);
+    return ACIRC_OK;
+}
+
+/* Packed-bit evaluation mod 2: ADD and SUB are XOR, MUL is AND. */
+
+static void bits_block(const acirc_plan *p, uint64_t *vals, const uint64_t *xs,
+                       size_t stride, size_t w, const int *ext)
+{
+    const acircref *args = p->args;
+
+    for (size_t i = 0; i < p->n; ++i) {
+        uint64_t *restrict dst = &vals[p->slots[i] * PLAN_LANES];
+        const size_t n = p->nargs[i];
+        switch (p->ops[i]) {
+        case OP_INPUT: {
+            const uint64_t *x = &xs[args[0] * stride];
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = x[l];
+            break;
+        }
+        case OP_CONST: case OP_EXTERNAL: {
+            const int val = p->ops[i] == OP_CONST ? args[1] : ext[i];
+            const uint64_t bits = (val & 1) ? UINT64_MAX : 0;
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = bits;
+            break;
+        }
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_SET: {
+            if (n == 0) {
+                const uint64_t unit = p->ops[i] == OP_MUL ? UINT64_MAX : 0;
+                for (size_t l = 0; l < w; ++l)
+                    dst[l] = unit;
+                break;
+            }
+            const uint64_t *a = &vals[args[0] * PLAN_LANES];
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = a[l];
+            for (size_t j = 1; j < n; ++j) {
+                const uint64_t *b = &vals[args[j] * PLAN_LANES];
+                if (p->ops[i] == OP_MUL)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] &= b[l];
+                else if (p->ops[i] != OP_SET)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] ^= b[l];
+            }
+            break;
+        }
+        }
+        args += n;
+    }
+}
+
+int acirc_eval_bits(acirc_plan *p, const uint64_t *xs, uint64_t *ys, size_t nwords)
+{
+    uint64_t *vals;
+    int *ext;
+    bool ok;
+
+    if (batch_check(p) == ACIRC_ERR)
+        return ACIRC_ERR;
+    ext = batch_externals(p, &ok);
+    if (!ok) {
+        free(ext);
+        return ACIRC_ERR;
+    }
+    vals = acirc_calloc((p->nslots + 1) * PLAN_LANES, sizeof vals[0]);
+    for (size_t start = 0; start < nwords; start += PLAN_LANES) {
+        const size_t w = nwords - start < PLAN_LANES ? nwords - start : PLAN_LANES;
+        bits_block(p, vals, xs + start, nwords, w, ext);
+        for (size_t o = 0; o < p->noutputs; ++o)
+            memcpy(&ys[o * nwords + start], &vals[p->outputs[o] * PLAN_LANES],
+                   w * sizeof ys[0]);
+    }
+    free(vals);
+    free(ext);
+    return ACIRC_OK;
+}
+
+/* Evaluation modulo an odd word-sized modulus.  Values are kept in Montgomery
+ * form from the inputs to the outputs, so every gate is word arithmetic with
+ * no division; lanes are blocked as in the batch evaluator. */
+
+static inline uint64_t u64_reduce(long x, uint64_t m)
+{
+    const uint64_t r = (uint64_t) (x < 0 ? -(x + 1) : x) % m;
+    return x < 0 ? m - 1 - r : r;
+}
+
+static void u64_block(const acirc_plan *p, uint64_t *vals, size_t lanes,
+                      const uint64_t *xs, size_t stride, size_t w,
+                      const uint64_t *ext, const mont_t *m)
+{
+    const acircref *args = p->args;
+    const uint64_t q = m->p, qinv = m->pinv;
+
+    for (size_t i = 0; i < p->n; ++i) {
+        uint64_t *restrict dst = &vals[p->slots[i] * lanes];
+        const size_t n = p->nargs[i];
+        switch (p->ops[i]) {
+        case OP_INPUT: {
+            const uint64_t *x = &xs[args[0] * stride];
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = mont_to(m, x[l]);
+            break;
+        }
+        case OP_CONST: case OP_EXTERNAL: {
+            const uint64_t val = p->ops[i] == OP_CONST
+                ? mont_to(m, u64_reduce(args[1], q)) : ext[i];
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = val;
+            break;
+        }
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_SET: {
+            if (n == 0) {
+                const uint64_t unit = p->ops[i] == OP_MUL ? m->one : 0;
+                for (size_t l = 0; l < w; ++l)
+                    dst[l] = unit;
+                break;
+            }
+            const uint64_t *a = &vals[args[0] * lanes];
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = a[l];
+            for (size_t j = 1; j < n; ++j) {
+                const uint64_t *b = &vals[args[j] * lanes];
+                if (p->ops[i] == OP_ADD)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] = mont_add(dst[l], b[l], q);
+                else if (p->ops[i] == OP_SUB)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] = mont_sub(dst[l], b[l], q);
+                else if (p->ops[i] == OP_MUL)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] = mont_mul(dst[l], b[l], q, qinv);
+            }
+            break;
+        }
+        }
+        args += n;
+    }
+}
+
+/* checks the modulus and plan, and evaluates the external gates, already in
+ * Montgomery form */
+static int u64_setup(const acirc_plan *p, uint64_t modulus, mont_t *m, uint64_t **ext)
+{
+    int *vals;
+    bool ok;
+
+    *ext = NULL;
+    if (modulus < 3 || modulus % 2 == 0 || modulus >> 62) {
+        fprintf(stderr, "error: modulus must be odd and in [3, 2^62)\n");
+        return ACIRC_ERR;
+    }
+    if (batch_check(p) == ACIRC_ERR)
+        return ACIRC_ERR;
+    mont_init(m, modulus);
+    vals = batch_externals(p, &ok);
+    if (vals) {
+        *ext = acirc_calloc(p->n, sizeof (*ext)[0]);
+        for (size_t i = 0; i < p->n; ++i)
+            (*ext)[i] = mont_to(m, u64_reduce(vals[i], modulus));
+        free(vals);
+    }
+    if (!ok) {
+        free(*ext);
+        *ext = NULL;
+        return ACIRC_ERR;
+    }
+    return ACIRC_OK;
+}
+
+int acirc_eval_u64_mod(acirc_plan *p, const uint64_t *xs, uint64_t *ys,
+                       uint64_t modulus)
+{
+    uint64_t *vals, *ext;
+    mont_t m;
+
+    if (u64_setup(p, modulus, &m, &ext) == ACIRC_ERR)
+        return ACIRC_ERR;
+    vals = acirc_calloc(p->nslots + 1, sizeof vals[0]);
+    u64_block(p, vals, 1, xs, 1, 1, ext, &m);
+    for (size_t o = 0; o < p->noutputs; ++o)
+        ys[o] = mont_from(&m, vals[p->outputs[o]]);
+    free(vals);
+    free(ext);
+    return ACIRC_OK;
+}
+
+int acirc_eval_u64_mod_batch(acirc_plan *p, const uint64_t *xs, uint64_t *ys,
+                             size_t nlanes, uint64_t modulus)
+{
+    uint64_t *vals, *ext;
+    mont_t m;
+
+    if (u64_setup(p, modulus, &m, &ext) == ACIRC_ERR)
+        return ACIRC_ERR;
+    vals = acirc_calloc((p->nslots + 1) * PLAN_LANES, sizeof vals[0]);
+    for (size_t start = 0; start < nlanes; start += PLAN_LANES) {
+        const size_t w = nlanes - start < PLAN_LANES ? nlanes - start : PLAN_LANES;
+        u64_block(p, vals, PLAN_LANES, xs + start, nlanes, w, ext, &m);
+        for (size_t o = 0; o < p->noutputs; ++o) {
+            const uint64_t *v = &vals[p->outputs[o] * PLAN_LANES];
+            uint64_t *y = &ys[o * nlanes + start];
+            for (size_t l = 0; l < w; ++l)
+                y[l] = mont_from(&m, v[l]);
+        }
+    }
+    free(vals);
+    free(ext);
+    return ACIRC_OK;
+}
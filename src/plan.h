@@ -0,0 +1,42 @@
+#pragma once
+
+#include "acirc.h"
+
+/* A plan is the topological order of everything the outputs depend on, with
+ * each gate's op and arguments copied out in that order, so evaluation is a
+ * single forward sweep over contiguous memory.  Values live in slots rather
+ * than being indexed by ref: a slot is recycled once the last gate reading it
+ * has run, which keeps the scratch space proportional to the widest cut of
+ * the circuit and lets the batch evaluators keep many lanes per slot. */
+struct acirc_plan {
+    const acirc *c;
+    size_t n;                   /* number of steps */
+    acircref *refs;             /* ref computed by each step */
+    uint8_t *ops;
+    uint32_t *nargs;
+    acircref *args;             /* arguments of every step, back to back, as
+                                 * slots for ADD/SUB/MUL/SET */
+    size_t *slots;              /* slot written by each step */
+    size_t nslots;
+    size_t *outputs;            /* slot holding each output */
+    size_t noutputs;
+    int *vals;                  /* scalar scratch, indexed by slot */
+
+    /* Level schedule for the parallel evaluators, built on first use: the
+     * steps of level k are level_steps[level_offsets[k]] ..
+     * level_steps[level_offsets[k + 1] - 1], and depend only on steps of
+     * earlier levels. */
+    size_t nlevels;
+    size_t *level_offsets;
+    size_t *level_steps;
+
+    /* Dependency graph between steps, built on first use: step i waits on
+     * npreds[i] argument edges, and the steps reading it are
+     * succs[succ_offsets[i]] .. succs[succ_offsets[i + 1] - 1]. */
+    uint32_t *npreds;
+    size_t *succ_offsets;
+    size_t *succs;
+};
+
+void plan_levels(acirc_plan *p);
+void plan_dag(acirc_plan *p);
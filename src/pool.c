@@ -0,0 +1,150 @@
+#include "pool.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Persistent thread pool.  Workers sleep on a condition variable between
+ * jobs, so a pool can be created once and used for many evaluations. */
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t n, count, gen;
+} barrier_t;
+
+struct acirc_pool {
+    size_t nthreads;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    size_t gen;                 /* bumped for every job */
+    size_t pending;             /* workers still running the current job */
+    bool stop;
+    pool_fn fn;
+    void *arg;
+    barrier_t barrier;
+};
+
+typedef struct {
+    acirc_pool *pool;
+    size_t tid;
+} worker_t;
+
+static void * pool_worker(void *vargs)
+{
+    worker_t *w = vargs;
+    acirc_pool *pool = w->pool;
+    const size_t tid = w->tid;
+    size_t seen = 0;
+
+    free(w);
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->gen == seen && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop)
+            break;
+        seen = pool->gen;
+        pool_fn fn = pool->fn;
+        void *arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+        fn(arg, tid);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+acirc_pool * acirc_pool_new(size_t nthreads)
+{
+    acirc_pool *pool = acirc_calloc(1, sizeof pool[0]);
+
+    if (nthreads == 0) {
+        const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? ncpus : 1;
+    }
+    pool->nthreads = nthreads;
+    pool->threads = acirc_calloc(nthreads, sizeof pool->threads[0]);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pthread_mutex_init(&pool->barrier.lock, NULL);
+    pthread_cond_init(&pool->barrier.cond, NULL);
+    pool->barrier.n = nthreads;
+    for (size_t i = 1; i < nthreads; ++i) {
+        worker_t *w = acirc_calloc(1, sizeof w[0]);
+        w->pool = pool;
+        w->tid = i;
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, w) != 0) {
+            fprintf(stderr, "error: unable to start thread %lu\n", i);
+            abort();
+        }
+    }
+    return pool;
+}
+
+void acirc_pool_free(acirc_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 1; i < pool->nthreads; ++i)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->barrier.lock);
+    pthread_cond_destroy(&pool->barrier.cond);
+    free(pool->threads);
+    free(pool);
+}
+
+size_t pool_nthreads(const acirc_pool *pool)
+{
+    return pool->nthreads;
+}
+
+void pool_run(acirc_pool *pool, pool_fn fn, void *arg)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->pending = pool->nthreads - 1;
+    pool->gen++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    fn(arg, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_barrier(acirc_pool *pool)
+{
+    barrier_t *b = &pool->barrier;
+    size_t gen;
+
+    if (b->n == 1)
+        return;
+    pthread_mutex_lock(&b->lock);
+    gen = b->gen;
+    if (++b->count == b->n) {
+        b->count = 0;
+        b->gen++;
+        pthread_cond_broadcast(&b->cond);
+    } else {
+        while (gen == b->gen)
+            pthread_cond_wait(&b->cond, &b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
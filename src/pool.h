@@ -0,0 +1,12 @@
+#pragma once
+
+#include "acirc.h"
+
+/* Runs fn(arg, tid) on every thread of the pool, the caller being thread 0,
+ * and returns once all of them have finished.  Inside fn, pool_barrier
+ * blocks until every thread has reached it. */
+typedef void (*pool_fn)(void *arg, size_t tid);
+
+void pool_run(acirc_pool *pool, pool_fn fn, void *arg);
+void pool_barrier(acirc_pool *pool);
+size_t pool_nthreads(const acirc_pool *pool);
@@ -0,0 +1,318 @@
+#include "acirc.h"
+
+#ifdef HAVE_GMP
+
+#include "mont.h"
+#include "plan.h"
+#include "pool.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Residue number system evaluation.  Every value is carried as its residues
+ * modulo k word-sized primes, whose product P exceeds twice the largest
+ * output the plan can produce from inputs in [0, modulus).  Gates are then
+ * independent word operations in each channel, and the channels are spread
+ * over the pool.  At the end each output x is rebuilt by CRT directly modulo
+ * the real modulus: with r_i the residue of x times the CRT inverse,
+ *
+ *     x = sum_i r_i (P / p_i) - t P,    t = round(sum_i r_i / p_i),
+ *
+ * where the cofactors P / p_i and P itself are kept reduced modulo the
+ * modulus, and t is found in floating point.  One spare channel keeps |x| / P
+ * tiny, so that the sum is always close to an integer and rounds safely. */
+
+/* channel primes are just below 2^62, so each carries more than 61 bits */
+#define RNS_PRIME_BITS 61
+/* channels evaluated together by one thread */
+#define RNS_BLOCK 16
+/* plans whose outputs could exceed this many bits are refused */
+#define RNS_MAX_BITS ((size_t) 1 << 24)
+
+_Static_assert(sizeof(unsigned long) >= sizeof(uint64_t),
+               "channel residues are passed to GMP as unsigned long");
+
+struct acirc_rns {
+    acirc_plan *p;
+    mpz_t modulus;
+    size_t k;                   /* number of channels */
+    mont_t *monts;              /* arithmetic modulo each channel's prime */
+    mpz_t prod;                 /* product of the primes, mod modulus */
+    mpz_t *cofactors;           /* product / prime mod modulus, per channel */
+    uint64_t *inverses;         /* (product / prime)^-1 mod prime */
+};
+
+static size_t clog2(size_t n)
+{
+    size_t b = 0;
+    while (((size_t) 1 << b) < n)
+        b++;
+    return b;
+}
+
+/* Bounds the bit length of every output's absolute value when all inputs
+ * and constants have at most mbits bits. */
+static int rns_bits(const acirc_plan *p, size_t mbits, size_t *out)
+{
+    size_t *bits = acirc_calloc(p->nslots + 1, sizeof bits[0]);
+    const acircref *args = p->args;
+    size_t max = 0;
+    int ret = ACIRC_OK;
+
+    for (size_t i = 0; i < p->n && ret == ACIRC_OK; ++i) {
+        const size_t n = p->nargs[i];
+        size_t b = 0;
+        switch (p->ops[i]) {
+        case OP_INPUT: case OP_CONST:
+            b = mbits;
+            break;
+        case OP_ADD: case OP_SUB:
+            for (size_t j = 0; j < n; ++j)
+                b = bits[args[j]] > b ? bits[args[j]] : b;
+            b += clog2(n);
+            if (p->ops[i] == OP_SUB && n == 0)
+                ret = ACIRC_ERR;
+            break;
+        case OP_MUL:
+            b = n == 0 ? 1 : 0;
+            for (size_t j = 0; j < n; ++j)
+                b += bits[args[j]];
+            break;
+        case OP_SET:
+            if (n == 0)
+                ret = ACIRC_ERR;
+            else
+                b = bits[args[0]];
+            break;
+        default:
+            ret = ACIRC_ERR;
+            break;
+        }
+        /* saturate, so that the sums above cannot overflow */
+        bits[p->slots[i]] = b > RNS_MAX_BITS ? RNS_MAX_BITS + 1 : b;
+        args += n;
+    }
+    for (size_t o = 0; o < p->noutputs; ++o)
+        max = bits[p->outputs[o]] > max ? bits[p->outputs[o]] : max;
+    free(bits);
+    *out = max;
+    return ret;
+}
+
+static void rns_primes(acirc_rns *r)
+{
+    mpz_t q, inv, prod, cofactor;
+
+    mpz_inits(q, inv, prod, cofactor, NULL);
+    mpz_set_ui(q, ((uint64_t) 1 << 62) - 1);
+    mpz_set_ui(prod, 1);
+    for (size_t i = 0; i < r->k; mpz_sub_ui(q, q, 2)) {
+        if (mpz_probab_prime_p(q, 25) == 0)
+            continue;
+        mont_init(&r->monts[i++], mpz_get_ui(q));
+        mpz_mul(prod, prod, q);
+    }
+    mpz_mod(r->prod, prod, r->modulus);
+    for (size_t i = 0; i < r->k; ++i) {
+        mpz_divexact_ui(cofactor, prod, r->monts[i].p);
+        mpz_init(r->cofactors[i]);
+        mpz_mod(r->cofactors[i], cofactor, r->modulus);
+        mpz_set_ui(q, r->monts[i].p);
+        mpz_invert(inv, cofactor, q);
+        r->inverses[i] = mpz_get_ui(inv);
+    }
+    mpz_clears(q, inv, prod, cofactor, NULL);
+}
+
+acirc_rns * acirc_rns_new(acirc_plan *p, const mpz_t modulus)
+{
+    acirc_rns *r;
+    size_t bits;
+
+    if (rns_bits(p, mpz_sizeinbase(modulus, 2), &bits) == ACIRC_ERR) {
+        fprintf(stderr, "error: rns: unsupported gate in circuit\n");
+        return NULL;
+    }
+    if (bits > RNS_MAX_BITS) {
+        fprintf(stderr, "error: rns: outputs may need more than %lu bits\n",
+                (unsigned long) RNS_MAX_BITS);
+        return NULL;
+    }
+    r = acirc_calloc(1, sizeof r[0]);
+    r->p = p;
+    mpz_init_set(r->modulus, modulus);
+    /* room for the sign, prod > 2^(bits + 1), plus the spare channel */
+    r->k = (bits + RNS_PRIME_BITS) / RNS_PRIME_BITS + 1;
+    r->monts = acirc_calloc(r->k, sizeof r->monts[0]);
+    r->cofactors = acirc_calloc(r->k, sizeof r->cofactors[0]);
+    r->inverses = acirc_calloc(r->k, sizeof r->inverses[0]);
+    mpz_init(r->prod);
+    rns_primes(r);
+    return r;
+}
+
+void acirc_rns_free(acirc_rns *r)
+{
+    if (r == NULL)
+        return;
+    for (size_t i = 0; i < r->k; ++i)
+        mpz_clear(r->cofactors[i]);
+    mpz_clears(r->modulus, r->prod, NULL);
+    free(r->monts);
+    free(r->cofactors);
+    free(r->inverses);
+    free(r);
+}
+
+size_t acirc_rns_nchannels(const acirc_rns *r)
+{
+    return r->k;
+}
+
+typedef struct {
+    const acirc_rns *r;
+    size_t nthreads;
+    mpz_t *xs, *ys;             /* reduced modulo r->modulus */
+    uint64_t *outs;             /* output o in channel i is outs[o * k + i],
+                                 * already multiplied by inverses[i] */
+    mpz_t *rops;
+} rns_job_t;
+
+/* Runs the plan over channels lo .. lo + w - 1.  Each slot holds a block of
+ * channels side by side, so every gate is a loop over independent channels,
+ * and blocks are small enough that the slots stay in cache. */
+static void rns_block(const rns_job_t *job, uint64_t *vals, size_t lo, size_t w)
+{
+    const acirc_rns *r = job->r;
+    const acirc_plan *p = r->p;
+    const mont_t *m = &r->monts[lo];
+    const acircref *args = p->args;
+
+    for (size_t i = 0; i < p->n; ++i) {
+        uint64_t *restrict dst = &vals[p->slots[i] * RNS_BLOCK];
+        const size_t n = p->nargs[i];
+        switch (p->ops[i]) {
+        case OP_INPUT: case OP_CONST: {
+            mpz_srcptr x = p->ops[i] == OP_INPUT ? job->xs[args[0]] : job->ys[args[0]];
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = mont_to(&m[l], mpz_fdiv_ui(x, m[l].p));
+            break;
+        }
+        default: {
+            if (n == 0) {
+                for (size_t l = 0; l < w; ++l)
+                    dst[l] = p->ops[i] == OP_MUL ? m[l].one : 0;
+                break;
+            }
+            const uint64_t *a = &vals[args[0] * RNS_BLOCK];
+            for (size_t l = 0; l < w; ++l)
+                dst[l] = a[l];
+            for (size_t j = 1; j < n; ++j) {
+                const uint64_t *b = &vals[args[j] * RNS_BLOCK];
+                if (p->ops[i] == OP_ADD)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] = mont_add(dst[l], b[l], m[l].p);
+                else if (p->ops[i] == OP_SUB)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] = mont_sub(dst[l], b[l], m[l].p);
+                else if (p->ops[i] == OP_MUL)
+                    for (size_t l = 0; l < w; ++l)
+                        dst[l] = mont_mul(dst[l], b[l], m[l].p, m[l].pinv);
+            }
+            break;
+        }
+        }
+        args += n;
+    }
+    /* leaving Montgomery form and multiplying by the CRT inverse is a
+     * single Montgomery product */
+    for (size_t o = 0; o < p->noutputs; ++o) {
+        const uint64_t *v = &vals[p->outputs[o] * RNS_BLOCK];
+        uint64_t *out = &job->outs[o * r->k + lo];
+        for (size_t l = 0; l < w; ++l)
+            out[l] = mont_mul(v[l], r->inverses[lo + l], m[l].p, m[l].pinv);
+    }
+}
+
+/* each thread takes a contiguous share of the channels */
+static void rns_channels(void *vargs, size_t tid)
+{
+    rns_job_t *job = vargs;
+    const acirc_rns *r = job->r;
+    const size_t lo = r->k * tid / job->nthreads;
+    const size_t hi = r->k * (tid + 1) / job->nthreads;
+    uint64_t *vals;
+
+    if (lo == hi)
+        return;
+    vals = acirc_calloc((r->p->nslots + 1) * RNS_BLOCK, sizeof vals[0]);
+    for (size_t b = lo; b < hi; b += RNS_BLOCK)
+        rns_block(job, vals, b, hi - b < RNS_BLOCK ? hi - b : RNS_BLOCK);
+    free(vals);
+}
+
+/* CRT reconstruction, one output at a time per thread */
+static void rns_crt(void *vargs, size_t tid)
+{
+    rns_job_t *job = vargs;
+    const acirc_rns *r = job->r;
+    mpz_t acc;
+
+    mpz_init(acc);
+    for (size_t o = tid; o < r->p->noutputs; o += job->nthreads) {
+        const uint64_t *out = &job->outs[o * r->k];
+        double t = 0.0;
+        mpz_set_ui(acc, 0);
+        for (size_t i = 0; i < r->k; ++i) {
+            mpz_addmul_ui(acc, r->cofactors[i], out[i]);
+            t += (double) out[i] / (double) r->monts[i].p;
+        }
+        mpz_submul_ui(acc, r->prod, (unsigned long) (t + 0.5));
+        mpz_mod(job->rops[o], acc, r->modulus);
+    }
+    mpz_clear(acc);
+}
+
+static mpz_t * rns_reduce(mpz_t *xs, size_t n, const mpz_t modulus)
+{
+    mpz_t *rs = acirc_calloc(n + 1, sizeof rs[0]);
+    for (size_t i = 0; i < n; ++i) {
+        mpz_init(rs[i]);
+        mpz_mod(rs[i], xs[i], modulus);
+    }
+    return rs;
+}
+
+static void rns_reduce_free(mpz_t *rs, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        mpz_clear(rs[i]);
+    free(rs);
+}
+
+int acirc_eval_rns(acirc_pool *pool, acirc_rns *r, mpz_t *rops, mpz_t *xs, mpz_t *ys)
+{
+    const acirc *c = r->p->c;
+    rns_job_t job;
+
+    job.r = r;
+    job.nthreads = pool ? pool_nthreads(pool) : 1;
+    job.xs = rns_reduce(xs, c->ninputs, r->modulus);
+    job.ys = rns_reduce(ys, c->consts.n, r->modulus);
+    job.outs = acirc_calloc(r->p->noutputs * r->k + 1, sizeof job.outs[0]);
+    job.rops = rops;
+    if (pool) {
+        pool_run(pool, rns_channels, &job);
+        pool_run(pool, rns_crt, &job);
+    } else {
+        rns_channels(&job, 0);
+        rns_crt(&job, 0);
+    }
+    rns_reduce_free(job.xs, c->ninputs);
+    rns_reduce_free(job.ys, c->consts.n);
+    free(job.outs);
+    return ACIRC_OK;
+}
+
+#endif
@@ -0,0 +1,184 @@
+#include "stats.h"
+#include "utils.h"
+#include "walk.h"
+
+#include <stdlib.h>
+
+acirc_stats_cache * stats_new(void)
+{
+    acirc_stats_cache *s = acirc_calloc(1, sizeof s[0]);
+    pthread_mutex_init(&s->lock, NULL);
+    atomic_init(&s->valid, false);
+    atomic_init(&s->degrees_valid, false);
+    return s;
+}
+
+void stats_free(acirc_stats_cache *s)
+{
+    if (s) {
+        pthread_mutex_destroy(&s->lock);
+        free(s->degrees);
+        free(s->order);
+        free(s->level_offsets);
+        free(s->level_steps);
+        free(s);
+    }
+}
+
+void acirc_invalidate_stats(acirc *c)
+{
+    acirc_stats_cache *s = c->stats;
+    if (s) {
+        atomic_store(&s->valid, false);
+        atomic_store(&s->degrees_valid, false);
+        free(s->order);
+        free(s->level_offsets);
+        free(s->level_steps);
+        s->order = NULL;
+        s->level_offsets = s->level_steps = NULL;
+    }
+}
+
+/* the outputs' topological order, if one was loaded */
+const acircref * stats_order(const acirc *c, size_t *n)
+{
+    const acirc_stats_cache *s = c->stats;
+    if (!atomic_load(&s->valid) || s->order == NULL)
+        return NULL;
+    *n = s->norder;
+    return s->order;
+}
+
+/* depth, degree and total degree of every ref, filled in by one walk */
+typedef struct {
+    size_t *depth;
+    size_t *degree;
+    size_t *total;
+} stats_walk_t;
+
+static void stats_fn(void *data, const acirc *c, acircref ref)
+{
+    stats_walk_t *s = data;
+    const acirc_gate_t gate = acirc_gate(c, ref);
+    size_t depth = 0, degree = 0, total = 0;
+
+    switch (gate.op) {
+    case OP_INPUT: case OP_CONST:
+        degree = total = 1;
+        break;
+    case OP_ADD: case OP_SUB: case OP_MUL:
+        for (size_t i = 0; i < gate.nargs; ++i) {
+            const acircref arg = gate.args[i];
+            if (s->depth[arg] > depth)
+                depth = s->depth[arg];
+            if (gate.op == OP_MUL)
+                degree += s->degree[arg];
+            else if (s->degree[arg] > degree)
+                degree = s->degree[arg];
+            total += s->total[arg];
+        }
+        depth++;
+        break;
+    case OP_SET:
+        depth = s->depth[gate.args[0]];
+        degree = s->degree[gate.args[0]];
+        total = s->total[gate.args[0]];
+        break;
+    default:
+        abort();
+    }
+    s->depth[ref] = depth;
+    s->degree[ref] = degree;
+    s->total[ref] = total;
+}
+
+static void stats_build(const acirc *c, acirc_stats_cache *cache)
+{
+    const size_t nrefs = acirc_nrefs(c);
+    acirc_stats_t *st = &cache->stats;
+    walk_t *w = walk_acquire(c);
+    size_t *vals = acirc_calloc(3 * (nrefs + 1), sizeof vals[0]);
+    stats_walk_t s = { vals, vals + nrefs + 1, vals + 2 * (nrefs + 1) };
+
+    st->depth = st->degree = st->total_degree = 0;
+    walk_begin(w, c);
+    for (size_t i = 0; i < c->outputs.n; ++i) {
+        const acircref out = c->outputs.buf[i];
+        walk_from(w, c, out, NULL, stats_fn, &s);
+        if (s.depth[out] > st->depth)
+            st->depth = s.depth[out];
+        if (s.degree[out] > st->degree)
+            st->degree = s.degree[out];
+        if (s.total[out] > st->total_degree)
+            st->total_degree = s.total[out];
+    }
+    walk_release(c, w);
+    free(vals);
+
+    st->nmuls = 0;
+    for (size_t ref = 0; ref < nrefs; ++ref)
+        if (acirc_op(c, ref) == OP_MUL)
+            st->nmuls++;
+}
+
+const acirc_stats_t * acirc_stats(const acirc *c)
+{
+    acirc_stats_cache *cache = c->stats;
+
+    if (!atomic_load(&cache->valid)) {
+        pthread_mutex_lock(&cache->lock);
+        if (!atomic_load(&cache->valid)) {
+            stats_build(c, cache);
+            atomic_store(&cache->valid, true);
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    return &cache->stats;
+}
+
+const size_t * acirc_stats_degrees(const acirc *c, acirc_pool *pool)
+{
+    acirc_stats_cache *cache = c->stats;
+
+    if (!atomic_load(&cache->degrees_valid)) {
+        pthread_mutex_lock(&cache->lock);
+        if (!atomic_load(&cache->degrees_valid)) {
+            free(cache->degrees);
+            cache->degrees = acirc_calloc(c->ninputs + 1, sizeof cache->degrees[0]);
+            circuit_degrees(c, pool, cache->degrees);
+            cache->delta = 0;
+            for (size_t i = 0; i < c->ninputs + 1; ++i)
+                cache->delta += cache->degrees[i];
+            atomic_store(&cache->degrees_valid, true);
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    return cache->degrees;
+}
+
+size_t acirc_max_depth(const acirc *c)
+{
+    return acirc_stats(c)->depth;
+}
+
+size_t acirc_max_degree(const acirc *c)
+{
+    return acirc_stats(c)->degree;
+}
+
+size_t acirc_max_total_degree(const acirc *c)
+{
+    return acirc_stats(c)->total_degree;
+}
+
+size_t acirc_nmuls(const acirc *c)
+{
+    return acirc_stats(c)->nmuls;
+}
+
+size_t acirc_delta(const acirc *c)
+{
+    const acirc_stats_cache *cache = c->stats;
+    (void) acirc_stats_degrees(c, NULL);
+    return cache->delta;
+}
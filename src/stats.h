@@ -0,0 +1,33 @@
+#pragma once
+
+#include "acirc.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Whole-circuit statistics, computed together on first use and kept on the
+ * circuit until a builder function modifies its gates or outputs.  The
+ * per-input degrees cost far more than the rest, so they are filled in
+ * separately, only once something asks for them.  Readers that find a part
+ * of the cache valid never take the lock.
+ *
+ * A cache loaded by acirc_fread_analysis also carries the outputs'
+ * topological order and its level schedule, in the layout of acirc_plan,
+ * which acirc_plan_new and plan_levels then copy instead of recomputing. */
+struct acirc_stats_cache {
+    pthread_mutex_t lock;
+    atomic_bool valid;
+    acirc_stats_t stats;
+    atomic_bool degrees_valid;
+    size_t *degrees;            /* acirc_stats_degrees */
+    size_t delta;
+    acircref *order;            /* NULL unless loaded */
+    size_t norder;
+    size_t nlevels;
+    size_t *level_offsets;
+    size_t *level_steps;
+};
+
+acirc_stats_cache * stats_new(void);
+void stats_free(acirc_stats_cache *s);
+const acircref * stats_order(const acirc *c, size_t *n);
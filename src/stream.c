@@ -0,0 +1,63 @@
+#include "acirc.h"
+#include "lines.h"
+
+#include <string.h>
+
+int acirc_fstream(FILE *fp, const acirc_callbacks_t *cbs, void *data)
+{
+    lines_t l;
+    int ret;
+    lines_init(&l);
+    ret = lines_fparse(&l, fp, cbs, data);
+    lines_clear(&l);
+    return ret;
+}
+
+static int counts_input(void *data, acircref ref, acircref id)
+{
+    (void) ref; (void) id;
+    ((acirc_counts_t *) data)->ninputs++;
+    return ACIRC_OK;
+}
+
+static int counts_const(void *data, acircref ref, int val)
+{
+    (void) ref; (void) val;
+    ((acirc_counts_t *) data)->nconsts++;
+    return ACIRC_OK;
+}
+
+static int counts_gate(void *data, acircref ref, acirc_operation op,
+                       const acircref *args, size_t nargs)
+{
+    acirc_counts_t *counts = data;
+    (void) ref; (void) args;
+    counts->ngates++;
+    counts->nargs += nargs;
+    if (op == OP_MUL)
+        counts->nmuls++;
+    return ACIRC_OK;
+}
+
+static int counts_command(void *data, const char *name, const char **strs, size_t n)
+{
+    acirc_counts_t *counts = data;
+    (void) strs;
+    if (strcmp(name, ":outputs") == 0)
+        counts->noutputs += n;
+    else if (strcmp(name, ":test") == 0)
+        counts->ntests++;
+    return ACIRC_OK;
+}
+
+int acirc_fcounts(FILE *fp, acirc_counts_t *counts)
+{
+    static const acirc_callbacks_t cbs = {
+        .input = counts_input,
+        .constant = counts_const,
+        .gate = counts_gate,
+        .command = counts_command,
+    };
+    memset(counts, '\0', sizeof counts[0]);
+    return acirc_fstream(fp, &cbs, counts);
+}
@@ -1,129 +1,100 @@
 #include "acirc.h"
 #include "utils.h"
+#include "walk.h"
 
 #include <stdlib.h>
 #include <string.h>
 
-static void topo_helper(int ref, acircref *topo, bool *seen, size_t *i, acirc *c)
+typedef struct {
+    acircref *topo;
+    size_t n;
+} topo_walk_t;
+
+static void topo_fn(void *data, const acirc *c, acircref ref)
 {
-    if (seen[ref])
-        return;
-    const acirc_gate_t *gate = &c->gates.gates[ref];
-    switch (gate->op) {
-    case OP_INPUT: case OP_CONST:
-        break;
-    case OP_ADD: case OP_SUB: case OP_MUL: case OP_EXTERNAL:
-        for (size_t j = 0; j < gate->nargs; ++j) {
-            topo_helper(gate->args[j], topo, seen, i, c);
-        }
-        break;
-    case OP_SET:
-        topo_helper(gate->args[0], topo, seen, i, c);
-        break;
-    }
-    topo[(*i)++] = ref;
-    seen[ref]    = true;
+    topo_walk_t *t = data;
+    (void) c;
+    t->topo[t->n++] = ref;
 }
 
 // returns the number of references in the topological order
 size_t acirc_topological_order(acircref *topo, acirc *c, acircref ref)
 {
-    bool seen[acirc_nrefs(c)];
-    size_t i = 0;
-    memset(seen, '\0', sizeof seen);
-    topo_helper(ref, topo, seen, &i, c);
-    return i;
+    return topological_order_roots(topo, c, &ref, 1);
 }
 
-// dependencies fills an array with the refs to the subcircuit rooted at ref.
-// deps is the target array, i is an index into it.
-static void dependencies_helper(acircref *deps, bool *seen, int *i, acirc *c, int ref)
+// topological order of the union of the subcircuits rooted at each of roots
+size_t topological_order_roots(acircref *topo, const acirc *c, const acircref *roots,
+                               size_t nroots)
 {
-    if (seen[ref])
-        return;
-    const acirc_gate_t *gate = &c->gates.gates[ref];
-    switch (gate->op) {
-    case OP_INPUT: case OP_CONST:
-        break;
-    case OP_ADD: case OP_SUB: case OP_MUL: case OP_EXTERNAL:
-        for (size_t j = 0; j < gate->nargs; ++j) {
-            deps[(*i)++] = gate->args[j];
-        }
-        for (size_t j = 0; j < gate->nargs; ++j) {
-            dependencies_helper(deps, seen, i, c, gate->args[j]);
-        }
-        seen[ref] = true;
-        break;
-    case OP_SET:
-        deps[(*i)++] = gate->args[0];
-        dependencies_helper(deps, seen, i, c, gate->args[0]);
-        seen[ref] = true;
-        break;
-    }
-}
-
-static int dependencies(acircref *deps, acirc *c, int ref)
-{
-    bool seen[acirc_nrefs(c)];
-    int ndeps = 0;
-    memset(seen, '\0', sizeof seen);
-    dependencies_helper(deps, seen, &ndeps, c, ref);
-    return ndeps;
+    walk_t *w = walk_acquire(c);
+    topo_walk_t t = { .topo = topo, .n = 0 };
+    walk_begin(w, c);
+    for (size_t j = 0; j < nroots; ++j)
+        walk_from(w, c, roots[j], NULL, topo_fn, &t);
+    walk_release(c, w);
+    return t.n;
 }
 
+// Assigns each ref in the cone of root to level 1 + the highest level among
+// its arguments (inputs and constants are level 0), in a single pass over a
+// topological order.  Within a level, refs keep their topological order.
 acirc_topo_levels * acirc_topological_levels(acirc *c, acircref root)
 {
-    acirc_topo_levels *topo = acirc_malloc(sizeof(acirc_topo_levels));
-
-    topo->levels      = acirc_malloc(acirc_nrefs(c) * sizeof(acircref));
-    topo->level_sizes = acirc_calloc(acirc_nrefs(c), sizeof(int));
-    int *level_alloc  = acirc_calloc(acirc_nrefs(c), sizeof(int));
-    acircref *topo_list = acirc_calloc(acirc_nrefs(c), sizeof(acircref));
-    acircref *deps      = acirc_malloc(2 * acirc_nrefs(c) * sizeof(acircref));
-
-    size_t max_level = 0;
-    acirc_topological_order(topo_list, c, root);
-
-    for (size_t i = 0; i < acirc_nrefs(c); i++) {
-        int ref = topo_list[i];
-        int ndeps = dependencies(deps, c, ref);
-
-        // find the right level for this ref
-        for (size_t j = 0; j < acirc_nrefs(c); j++) {
-            // if the ref has a dependency in this topological level, try the next level
-            bool has_dep = any_in_array(deps, ndeps, topo->levels[j], topo->level_sizes[j]);
-            if (has_dep) continue;
-            // otherwise the ref belongs on this level
-
-            // ensure space
-            if (level_alloc[j] == 0) {
-                level_alloc[j] = 2;
-                topo->levels[j] = acirc_malloc(level_alloc[j] * sizeof(int));
-            } else if (topo->level_sizes[j] + 1 >= level_alloc[j]) {
-                level_alloc[j] *= 2;
-                topo->levels[j] = acirc_realloc(topo->levels[j], level_alloc[j] * sizeof(int));
+    acirc_topo_levels *topo = acirc_calloc(1, sizeof topo[0]);
+    acircref *topo_list = acirc_calloc(acirc_nrefs(c) + 1, sizeof topo_list[0]);
+    int *level = acirc_calloc(acirc_nrefs(c) + 1, sizeof level[0]);
+    int *buf, *pos;
+    const size_t n = acirc_topological_order(topo_list, c, root);
+
+    for (size_t i = 0; i < n; i++) {
+        const acircref ref = topo_list[i];
+        const acirc_gate_t gate = acirc_gate(c, ref);
+        int lvl = 0;
+        switch (gate.op) {
+        case OP_INPUT: case OP_CONST:
+            break;
+        default:
+            for (size_t j = 0; j < gate.nargs; ++j) {
+                if (level[gate.args[j]] + 1 > lvl)
+                    lvl = level[gate.args[j]] + 1;
             }
-
-            topo->levels[j][topo->level_sizes[j]] = ref; // push this ref
-            topo->level_sizes[j] += 1;
-
-            if (j > max_level)
-                max_level = j;
-
-            break; // we've found the right level for this ref: stop searching
+            break;
         }
+        level[ref] = lvl;
+        if (lvl + 1 > topo->nlevels)
+            topo->nlevels = lvl + 1;
+    }
+
+    // the levels are consecutive runs of a single array
+    topo->levels = acirc_calloc(topo->nlevels + 1, sizeof topo->levels[0]);
+    topo->level_sizes = acirc_calloc(topo->nlevels + 1, sizeof topo->level_sizes[0]);
+    buf = acirc_calloc(n + 1, sizeof buf[0]);
+    pos = acirc_calloc(topo->nlevels + 1, sizeof pos[0]);
+    for (size_t i = 0; i < n; i++)
+        topo->level_sizes[level[topo_list[i]]]++;
+    for (int j = 0; j < topo->nlevels; j++) {
+        topo->levels[j] = buf + pos[j];
+        pos[j + 1] = pos[j] + topo->level_sizes[j];
+        if (topo->level_sizes[j] > topo->max_width)
+            topo->max_width = topo->level_sizes[j];
     }
-    topo->nlevels = max_level + 1;
+    for (size_t i = 0; i < n; i++) {
+        const acircref ref = topo_list[i];
+        buf[pos[level[ref]]++] = ref;
+    }
+    topo->nrefs = n;
+
+    free(pos);
+    free(level);
     free(topo_list);
-    free(deps);
-    free(level_alloc);
     return topo;
 }
 
 void acirc_topo_levels_destroy(acirc_topo_levels *topo)
 {
-    for (int i = 0; i < topo->nlevels; i++)
-        free(topo->levels[i]);
+    if (topo->nlevels)
+        free(topo->levels[0]);  // the start of the shared array
     free(topo->levels);
     free(topo->level_sizes);
     free(topo);
@@ -1,15 +1,99 @@
 #include "utils.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 uint32_t g_verbose = 0;
 
+/* moves gates that live in a read-only mapping onto the heap */
+static void gates_unmap(acirc *c)
+{
+    acirc_gates_t *g = &c->gates;
+    const size_t nrefs = acirc_nrefs(c);
+    uint8_t *ops;
+    uint32_t *nargs;
+    size_t *offsets;
+    acircref *args;
+
+    g->_alloc = nrefs > 2 ? nrefs : 2;
+    g->_args_alloc = g->_args_n > 4 ? g->_args_n : 4;
+    ops = acirc_calloc(g->_alloc, sizeof ops[0]);
+    nargs = acirc_calloc(g->_alloc, sizeof nargs[0]);
+    offsets = acirc_calloc(g->_alloc, sizeof offsets[0]);
+    args = acirc_calloc(g->_args_alloc, sizeof args[0]);
+    memcpy(ops, g->ops, nrefs * sizeof ops[0]);
+    memcpy(nargs, g->nargs, nrefs * sizeof nargs[0]);
+    memcpy(offsets, g->offsets, nrefs * sizeof offsets[0]);
+    memcpy(args, g->args, g->_args_n * sizeof args[0]);
+    munmap(g->_map, g->_map_len);
+    g->_map = NULL;
+    g->_map_len = 0;
+    g->ops = ops;
+    g->nargs = nargs;
+    g->offsets = offsets;
+    g->args = args;
+}
+
+static void gates_grow(acirc_gates_t *g, size_t alloc)
+{
+    g->ops = acirc_realloc(g->ops, alloc * sizeof g->ops[0]);
+    g->nargs = acirc_realloc(g->nargs, alloc * sizeof g->nargs[0]);
+    g->offsets = acirc_realloc(g->offsets, alloc * sizeof g->offsets[0]);
+    memset(&g->ops[g->_alloc], '\0', (alloc - g->_alloc) * sizeof g->ops[0]);
+    memset(&g->nargs[g->_alloc], '\0', (alloc - g->_alloc) * sizeof g->nargs[0]);
+    memset(&g->offsets[g->_alloc], '\0', (alloc - g->_alloc) * sizeof g->offsets[0]);
+    g->_alloc = alloc;
+}
+
 void ensure_gate_space(acirc *c, acircref ref)
 {
-    if ((size_t) ref >= c->gates._alloc) {
-        c->gates._alloc *= 2;
-        c->gates.gates = acirc_realloc(c->gates.gates, c->gates._alloc * sizeof(acirc_gate_t));
+    acirc_gates_t *g = &c->gates;
+    size_t alloc;
+
+    if (g->_map)
+        gates_unmap(c);
+    if ((size_t) ref < g->_alloc)
+        return;
+    alloc = g->_alloc;
+    while ((size_t) ref >= alloc)
+        alloc *= 2;
+    gates_grow(g, alloc);
+}
+
+/* reserves n slots at the end of the flat argument array, returning the
+ * offset of the first */
+size_t ensure_args_space(acirc *c, size_t n)
+{
+    acirc_gates_t *g = &c->gates;
+    const size_t off = g->_args_n;
+
+    if (g->_map)
+        gates_unmap(c);
+    if (g->_args_n + n > g->_args_alloc) {
+        while (g->_args_n + n > g->_args_alloc)
+            g->_args_alloc *= 2;
+        g->args = acirc_realloc(g->args, g->_args_alloc * sizeof g->args[0]);
+    }
+    g->_args_n += n;
+    return off;
+}
+
+/* grows the gate arrays to exactly the requested capacity, if they are
+ * smaller, so that later insertions don't reallocate */
+void reserve_space(acirc *c, size_t ngates, size_t nargs)
+{
+    acirc_gates_t *g = &c->gates;
+
+    if (g->_map)
+        gates_unmap(c);
+    if (ngates > g->_alloc)
+        gates_grow(g, ngates);
+    if (nargs > g->_args_alloc) {
+        g->_args_alloc = nargs;
+        g->args = acirc_realloc(g->args, g->_args_alloc * sizeof g->args[0]);
     }
 }
 
@@ -43,22 +127,18 @@ void * acirc_realloc(void *ptr, size_t size)
     return ptr_;
 }
 
-bool in_array(int x, int *ys, size_t len)
+/* parses a non-negative decimal reference, failing if it doesn't fit */
+int str2ref(const char *s, acircref *ref)
 {
-    for (size_t i = 0; i < len; i++) {
-        if (x == ys[i])
-            return true;
-    }
-    return false;
-}
+    char *end;
+    long long x;
 
-bool any_in_array(acircref *xs, int xlen, int *ys, size_t ylen)
-{
-    for (int i = 0; i < xlen; i++) {
-        if (in_array(xs[i], ys, ylen))
-            return true;
-    }
-    return false;
+    errno = 0;
+    x = strtoll(s, &end, 10);
+    if (errno || end == s || x < 0 || x > ACIRC_REF_MAX)
+        return ACIRC_ERR;
+    *ref = x;
+    return ACIRC_OK;
 }
 
 void array_printstring_rev(int *xs, size_t n)
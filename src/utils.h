@@ -5,12 +5,23 @@
 extern uint32_t g_verbose;
 
 void ensure_gate_space(acirc *c, acircref ref);
+size_t ensure_args_space(acirc *c, size_t n);
+void reserve_space(acirc *c, size_t ngates, size_t nargs);
+void acirc_invalidate(acirc *c);
+void acirc_invalidate_stats(acirc *c);
+void circuit_degrees(const acirc *c, acirc_pool *pool, size_t *degs);
+size_t topological_order_roots(acircref *topo, const acirc *c, const acircref *roots,
+                               size_t nroots);
 
 void * acirc_calloc(size_t nmemb, size_t size);
 void * acirc_malloc(size_t size);
 void * acirc_realloc(void *ptr, size_t size);
 
-bool in_array(int x, int *ys, size_t len);
-bool any_in_array(acircref *xs, int xlen, int *ys, size_t ylen);
+void acirc_arena_init(acirc_arena_t *a);
+void acirc_arena_clear(acirc_arena_t *a);
+void acirc_arena_reset(acirc_arena_t *a);
+
+int str2ref(const char *s, acircref *ref);
+
 void array_printstring_rev(int *bits, size_t n);
 
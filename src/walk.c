@@ -0,0 +1,112 @@
+#include "walk.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+walk_t * walk_new(void)
+{
+    walk_t *w = acirc_calloc(1, sizeof w[0]);
+    atomic_flag_clear(&w->busy);
+    return w;
+}
+
+void walk_free(walk_t *w)
+{
+    if (w) {
+        free(w->mark);
+        free(w->stack);
+        free(w->next);
+        free(w->vals);
+        free(w->refs);
+#ifdef HAVE_GMP
+        for (size_t i = 0; i < w->_mpz_n; ++i)
+            mpz_clear(w->mpz[i]);
+        free(w->mpz);
+#endif
+        free(w);
+    }
+}
+
+walk_t * walk_acquire(const acirc *c)
+{
+    walk_t *w = c->walk;
+    if (w && !atomic_flag_test_and_set(&w->busy))
+        return w;
+    return walk_new();
+}
+
+void walk_release(const acirc *c, walk_t *w)
+{
+    if (w == c->walk)
+        atomic_flag_clear(&w->busy);
+    else
+        walk_free(w);
+}
+
+void walk_begin(walk_t *w, const acirc *c)
+{
+    const size_t nrefs = acirc_nrefs(c) + 1;
+
+    if (nrefs > w->_alloc) {
+        size_t alloc = w->_alloc ? w->_alloc : 64;
+        while (alloc < nrefs)
+            alloc *= 2;
+        w->mark = acirc_realloc(w->mark, alloc * sizeof w->mark[0]);
+        memset(w->mark, '\0', alloc * sizeof w->mark[0]);
+        w->stack = acirc_realloc(w->stack, alloc * sizeof w->stack[0]);
+        w->next = acirc_realloc(w->next, alloc * sizeof w->next[0]);
+        w->vals = acirc_realloc(w->vals, alloc * sizeof w->vals[0]);
+        w->refs = acirc_realloc(w->refs, alloc * sizeof w->refs[0]);
+        w->_alloc = alloc;
+        w->epoch = 0;
+    }
+    if (++w->epoch == 0) {
+        memset(w->mark, '\0', w->_alloc * sizeof w->mark[0]);
+        w->epoch = 1;
+    }
+}
+
+/* the refs a gate depends on: none for inputs and constants, only the first
+ * argument for SET */
+static inline size_t walk_nchildren(const acirc *c, acircref ref)
+{
+    switch (acirc_op(c, ref)) {
+    case OP_INPUT: case OP_CONST:
+        return 0;
+    case OP_SET:
+        return acirc_nargs(c, ref) ? 1 : 0;
+    default:
+        return acirc_nargs(c, ref);
+    }
+}
+
+void walk_from(walk_t *w, const acirc *c, acircref root, const bool *known,
+               walk_fn fn, void *data)
+{
+    size_t sp = 0;
+
+    if (w->mark[root] == w->epoch || (known && known[root]))
+        return;
+    w->mark[root] = w->epoch;
+    w->stack[sp] = root;
+    w->next[sp++] = 0;
+    while (sp) {
+        const acircref ref = w->stack[sp - 1];
+        const size_t i = w->next[sp - 1];
+        if (i < walk_nchildren(c, ref)) {
+            const acircref child = acirc_args(c, ref)[i];
+            w->next[sp - 1]++;
+            if (w->mark[child] != w->epoch && !(known && known[child])) {
+                /* marking on push also stops a malformed, cyclic circuit
+                 * from looping forever */
+                w->mark[child] = w->epoch;
+                w->stack[sp] = child;
+                w->next[sp++] = 0;
+            }
+        } else {
+            sp--;
+            fn(data, c, ref);
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "acirc.h"
+
+#include <stdatomic.h>
+
+/* Explicit-stack post-order traversal.  A walk visits each ref in the cone of
+ * one or more roots exactly once, arguments before the gates that read them,
+ * so analyses can compute a value per ref from their arguments' values
+ * without recursing.  The scratch arrays are kept between walks and only grow,
+ * and visited marks are cleared by bumping an epoch, so starting a walk costs
+ * O(1) once the buffers are large enough. */
+typedef struct acirc_walk {
+    atomic_flag busy;           /* held by the circuit's current user */
+    size_t _alloc;
+    uint32_t *mark;             /* ref visited iff mark[ref] == epoch */
+    uint32_t epoch;
+    acircref *stack;
+    size_t *next;               /* next argument to visit, per stack entry */
+    size_t *vals;               /* per-ref results for the analyses */
+    acircref *refs;             /* per-ref scratch for evaluation */
+#ifdef HAVE_GMP
+    mpz_t *mpz;                 /* per-ref values for acirc_eval_mpz_mod */
+    size_t _mpz_n;              /* entries of mpz initialized so far */
+#endif
+} walk_t;
+
+typedef void (*walk_fn)(void *data, const acirc *c, acircref ref);
+
+walk_t * walk_new(void);
+void walk_free(walk_t *w);
+/* borrows the circuit's scratch, or a fresh one if another thread holds it */
+walk_t * walk_acquire(const acirc *c);
+void walk_release(const acirc *c, walk_t *w);
+
+/* starts a new walk: every ref is unvisited again */
+void walk_begin(walk_t *w, const acirc *c);
+/* calls fn on every unvisited ref in the cone of root, in post-order; refs
+ * with known[ref] set are treated as visited, as are their cones */
+void walk_from(walk_t *w, const acirc *c, acircref root, const bool *known,
+               walk_fn fn, void *data);
@@ -1,7 +1,29 @@
 #include <acirc.h>
 
+#include <stdlib.h>
+
 #define arraysize(x) (sizeof x / sizeof x[0])
 
+typedef struct {
+    acirc *c;
+    bool done[8];
+    bool early[8];
+} order_t;
+
+/* records any gate that runs before one of its arguments */
+static int check_order(void *data, acircref ref)
+{
+    order_t *o = data;
+    const acircref *args = acirc_args(o->c, ref);
+    if (acirc_op(o->c, ref) != OP_INPUT && acirc_op(o->c, ref) != OP_CONST) {
+        for (size_t i = 0; i < acirc_nargs(o->c, ref); ++i)
+            if (!o->done[args[i]])
+                o->early[ref] = true;
+    }
+    o->done[ref] = true;
+    return ACIRC_OK;
+}
+
 int main(void)
 {
     acirc c;
@@ -42,5 +64,169 @@ int main(void)
 
     acirc_clear(&c);
 
+    if (!result)
+        return !result;
+
+    /* batch insertion into preallocated space */
+    acirc_init(&c);
+    acirc_reserve(&c, 6, 11);
+    acirc_add_input(&c, 0, 0);
+    acirc_add_input(&c, 1, 1);
+    acirc_add_const(&c, 2, 5);
+    acirc_operation ops[3] = {OP_ADD, OP_MUL, OP_SUB};
+    size_t offsets[4] = {0, 3, 5, 7};
+    acircref refs[7] = {0, 1, 2, 3, 3, 4, 0};
+    if (acirc_add_gates(&c, 3, ops, offsets, refs, arraysize(ops)) != ACIRC_OK)
+        result = false;
+    int xs[2] = {1, 0};
+    if (acirc_eval(&c, 5, xs) != 35)
+        result = false;
+
+    /* two lanes at once, in both batch modes */
+    acirc_add_output(&c, 5);
+    acirc_plan *plan = acirc_plan_new(&c);
+    int lanes[4] = {1, 0, 0, 1}, ys[2];
+    if (acirc_eval_batch(plan, lanes, ys, 2) != ACIRC_OK || ys[0] != 35 || ys[1] != 36)
+        result = false;
+    uint64_t bits[2] = {1, 2}, ybits[1];
+    if (acirc_eval_bits(plan, bits, ybits, 1) != ACIRC_OK || (ybits[0] & 3) != 1)
+        result = false;
+    uint64_t xw[2] = {1, 0}, yw[1];
+    if (acirc_eval_u64_mod(plan, xw, yw, 31) != ACIRC_OK || yw[0] != 35 % 31)
+        result = false;
+    acirc_pool *pool = acirc_pool_new(2);
+    if (acirc_eval_par(pool, plan, xs, ys) != ACIRC_OK || ys[0] != 35)
+        result = false;
+    size_t degs[3];
+    acirc_max_degrees(pool, plan, degs);
+    if (degs[0] != acirc_var_degree(&c, 5, 0, NULL) || degs[1] != acirc_var_degree(&c, 5, 1, NULL)
+        || degs[2] != acirc_const_degree(&c, 5, NULL) || acirc_delta(&c) != 6)
+        result = false;
+    order_t order = { .c = &c };
+    if (acirc_eval_dag(pool, plan, check_order, &order) != ACIRC_OK)
+        result = false;
+    for (size_t i = 0; i < 6; ++i)
+        if (!order.done[i] || order.early[i])
+            result = false;
+    acirc_pool_free(pool);
+    acirc_plan_free(plan);
+
+    /* consumers, before and after the index is invalidated */
+    size_t n;
+    const acircref *cons = acirc_consumers(&c, 3, &n);
+    if (n != 2 || cons[0] != 4 || cons[1] != 4)
+        result = false;
+    acircref refs2[2] = {0, 3};
+    acirc_add_gate(&c, 6, OP_MUL, refs2, arraysize(refs2));
+    cons = acirc_consumers(&c, 0, &n);
+    if (n != 3 || cons[0] != 3 || cons[1] != 5 || cons[2] != 6)
+        result = false;
+
+    /* cached statistics follow new gates and new outputs */
+    if (acirc_nmuls(&c) != 2 || acirc_max_degree(&c) != 2)
+        result = false;
+    acircref refs3[2] = {6, 6};
+    acirc_add_gate(&c, 7, OP_MUL, refs3, arraysize(refs3));
+    if (acirc_nmuls(&c) != 3 || acirc_max_degree(&c) != 2)
+        result = false;
+    acirc_add_output(&c, 7);
+    if (acirc_max_degree(&c) != 4 || acirc_stats_degrees(&c, NULL)[0] != 4)
+        result = false;
+
+    acirc_clear(&c);
+
+    /* dead gates, a SET chain and a constant subtree all go away */
+    acirc_init(&c);
+    acirc_add_input(&c, 0, 0);
+    acirc_add_const(&c, 1, 3);
+    acirc_add_const(&c, 2, 4);
+    acircref opt[6][2] = {{1, 2}, {3, 3}, {4, 0}, {5, 5}, {6, 6}, {0, 0}};
+    acirc_add_gate(&c, 3, OP_MUL, opt[0], 2);       /* 12 */
+    acirc_add_gate(&c, 4, OP_SET, opt[1], 1);
+    acirc_add_gate(&c, 5, OP_ADD, opt[2], 2);       /* x + 12 */
+    acirc_add_gate(&c, 6, OP_SET, opt[3], 1);
+    acirc_add_gate(&c, 7, OP_SET, opt[4], 1);
+    acirc_add_gate(&c, 8, OP_MUL, opt[5], 2);       /* dead */
+    acirc_add_output(&c, 7);
+    char *opt_test[2] = {"1", "d"};
+    acirc_add_command(&c, ":test", (const char **) opt_test, arraysize(opt_test));
+    acirc *o = acirc_optimize(&c, ACIRC_OPT_ALL);
+    if (o == NULL || acirc_nrefs(o) != 3 || !acirc_ensure(o))
+        result = false;
+    acirc_clear(o);
+    free(o);
+    o = acirc_optimize(&c, 0);
+    if (o == NULL || acirc_nrefs(o) != acirc_nrefs(&c) || !acirc_ensure(o))
+        result = false;
+    acirc_clear(o);
+    free(o);
+    acirc_clear(&c);
+
+    /* repeated products, shared as they are added or afterwards */
+    acirc_init(&c);
+    acirc_add_input(&c, 0, 0);
+    acirc_add_input(&c, 1, 1);
+    acircref xy[2] = {0, 1}, yx[2] = {1, 0};
+    acirc_add_gate(&c, 2, OP_MUL, xy, 2);
+    acirc_add_gate(&c, 3, OP_MUL, yx, 2);
+    acircref sums[2][2] = {{2, 0}, {3, 0}};
+    acirc_add_gate(&c, 4, OP_ADD, sums[0], 2);
+    acirc_add_gate(&c, 5, OP_ADD, sums[1], 2);
+    acircref prods[2] = {4, 5};
+    acirc_add_gate(&c, 6, OP_MUL, prods, 2);
+    acirc_add_output(&c, 6);
+    o = acirc_optimize(&c, ACIRC_OPT_ALL);
+    if (o == NULL || acirc_nmuls(o) != 2 || acirc_nrefs(o) != 5)
+        result = false;
+    acirc_clear(o);
+    free(o);
+    acirc_hashcons(&c, true);
+    if (acirc_intern_gate(&c, OP_MUL, yx, 2) != 2 || acirc_intern_gate(&c, OP_ADD, sums[1], 2) != 4
+        || acirc_intern_gate(&c, OP_MUL, sums[0], 2) != 7)
+        result = false;
+    acirc_add_gate(&c, 8, OP_MUL, xy, 2);
+    if (acirc_op(&c, 8) != OP_SET || acirc_nmuls(&c) != 4)
+        result = false;
+    acirc_clear(&c);
+
+    /* constants are merged by value, even when a value is also a ref that
+     * was merged into another */
+    acirc_init(&c);
+    acirc_add_input(&c, 0, 0);
+    acirc_add_input(&c, 1, 1);
+    acirc_add_gate(&c, 2, OP_MUL, xy, 2);
+    acirc_add_gate(&c, 3, OP_MUL, xy, 2);
+    acirc_add_const(&c, 4, 3);
+    acirc_add_const(&c, 5, 2);
+    for (acircref ref = 2; ref <= 5; ++ref)
+        acirc_add_output(&c, ref);
+    const int cse_flags[2] = {ACIRC_OPT_ALL, ACIRC_OPT_CSE};
+    for (size_t i = 0; i < arraysize(cse_flags); ++i) {
+        o = acirc_optimize(&c, cse_flags[i]);
+        xs[0] = 1;
+        xs[1] = 1;
+        if (o == NULL || acirc_eval(o, o->outputs.buf[2], xs) != 3
+            || acirc_eval(o, o->outputs.buf[3], xs) != 2)
+            result = false;
+        acirc_clear(o);
+        free(o);
+    }
+    acirc_clear(&c);
+
+    /* a chain deeper than a recursive traversal's stack could hold */
+    const acircref deep = 1000000;
+    acirc_init(&c);
+    acirc_add_input(&c, 0, 0);
+    for (acircref ref = 1; ref <= deep; ++ref) {
+        acircref chain[2] = {ref - 1, ref - 1};
+        acirc_add_gate(&c, ref, OP_ADD, chain, arraysize(chain));
+    }
+    if (acirc_depth(&c, deep) != (size_t) deep || acirc_degree(&c, deep) != 1)
+        result = false;
+    xs[0] = 0;
+    if (acirc_eval(&c, deep, xs) != 0)
+        result = false;
+    acirc_clear(&c);
+
     return !result;
 }
@@ -1,4 +1,5 @@
 #include <acirc.h>
+#include "src/analysis.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -20,11 +21,24 @@ main(void)
         fclose(fp);
 
         result = acirc_ensure(&c);
+        result = result && acirc_ensure_u64(&c, ((uint64_t) 1 << 61) - 1);
+        result = result && acirc_ensure_u64(&c, 3);
+        if (!result)
+            return 1;
+
+        (void) remove("circuits/test_circ.acirc.analysis");
+        if (acirc_analysis_sidecar(&c, "circuits/test_circ.acirc") != ACIRC_OK)
+            return 1;
 
         fp = fopen("circuits/test_circ2.acirc", "w");
         acirc_fwrite(&c, fp);
         fclose(fp);
 
+        fp = fopen("circuits/test_circ.bin", "wb");
+        if (acirc_fwrite_bin(&c, fp) != ACIRC_OK)
+            return 1;
+        fclose(fp);
+
         acirc_clear(&c);
     }
 
@@ -36,11 +50,124 @@ main(void)
         if (c == NULL)
             return 1;
 
-        result = acirc_ensure(c);
+        /* the sidecar matches, until the outputs change */
+        fp = fopen("circuits/test_circ.acirc.analysis", "rb");
+        result = acirc_fread_analysis(c, fp) == ACIRC_OK
+            && acirc_max_depth(c) == acirc_depth(c, c->outputs.buf[0])
+            && acirc_max_degree(c) == acirc_degree(c, c->outputs.buf[0]);
+        result = result && acirc_ensure(c);
+
+        /* a body damaged under a matching header is rejected: here the
+         * order, which follows the header, five words of stats and
+         * ninputs + 1 words of degrees, is reversed */
+        {
+            const size_t start = sizeof(ana_header_t) + 8 * (5 + c->ninputs + 1);
+            FILE *bad = tmpfile();
+            char *buf;
+            size_t n = 0;
+            long len;
+
+            fseek(fp, 0, SEEK_END);
+            len = ftell(fp);
+            rewind(fp);
+            buf = malloc(len);
+            if (fread(buf, 1, len, fp) != (size_t) len)
+                result = false;
+            else
+                n = ((const ana_header_t *) buf)->norder;
+            for (size_t i = 0; i < n / 2; ++i) {
+                acircref *order = (acircref *) (buf + start), tmp = order[i];
+                order[i] = order[n - 1 - i];
+                order[n - 1 - i] = tmp;
+            }
+            fwrite(buf, 1, len, bad);
+            rewind(bad);
+            result = result && acirc_fread_analysis(c, bad) == ACIRC_ERR;
+            fclose(bad);
+            free(buf);
+        }
+
+        rewind(fp);
+        acirc_add_output(c, 0);
+        result = result && acirc_fread_analysis(c, fp) == ACIRC_ERR;
+        fclose(fp);
 
         acirc_clear(c);
         free(c);
     }
 
+    {
+        acirc *c;
+        c = acirc_mmap_read(NULL, "circuits/test_circ2.acirc");
+        if (c == NULL)
+            return 1;
+
+        result = result && acirc_ensure(c);
+
+        acirc_clear(c);
+        free(c);
+    }
+
+    {
+        acirc *c;
+        fp = fopen("circuits/test_circ.bin", "rb");
+        c = acirc_fread_bin(NULL, fp);
+        fclose(fp);
+        if (c == NULL)
+            return 1;
+
+        result = result && acirc_ensure(c);
+
+        fp = fopen("circuits/test_circ3.acirc", "w");
+        acirc_fwrite(c, fp);
+        fclose(fp);
+
+        acirc_clear(c);
+        free(c);
+    }
+
+    {
+        acirc *c;
+        fp = fopen("circuits/test_circ.acirc", "r");
+        c = acirc_fread_parallel(NULL, fp, 3);
+        fclose(fp);
+        if (c == NULL)
+            return 1;
+
+        result = result && acirc_ensure(c);
+
+        acirc_clear(c);
+        free(c);
+    }
+
+    {
+        acirc_parser *p = acirc_parser_new();
+        for (int i = 0; i < 2; ++i) {
+            acirc *c;
+            fp = fopen("circuits/test_circ.acirc", "r");
+            c = acirc_fread_ctx(p, NULL, fp);
+            fclose(fp);
+            if (c == NULL)
+                return 1;
+
+            result = result && acirc_ensure(c);
+
+            acirc_clear(c);
+            free(c);
+        }
+        acirc_parser_free(p);
+    }
+
+    {
+        acirc_counts_t counts;
+        fp = fopen("circuits/test_circ.acirc", "r");
+        if (acirc_fcounts(fp, &counts) != ACIRC_OK)
+            return 1;
+        fclose(fp);
+
+        result = result && counts.ninputs == 2 && counts.nconsts == 1
+            && counts.ngates == 2 && counts.noutputs == 1 && counts.ntests == 4;
+    }
+
     return !result;
 }
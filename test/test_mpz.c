@@ -23,5 +23,101 @@ main(void)
 
     result = acirc_ensure_mpz(c);
 
+    /* the RNS backend and the reusable context agree with the mpz evaluator
+     * on a large modulus, with inputs that are not reduced and an output that
+     * goes negative */
+    acircref args[3] = {3, 3, 0}, sub[2] = {1, 5};
+    acirc_add_gate(c, 5, OP_MUL, args, 3);
+    acirc_add_gate(c, 6, OP_SUB, sub, 2);
+    acirc_add_output(c, 6);
+    mpz_t xs[2], ys[1], rops[2], modulus, expected;
+    mpz_init_set_ui(ys[0], 5);
+    mpz_init(expected);
+    mpz_init(modulus);
+    mpz_ui_pow_ui(modulus, 2, 521);
+    mpz_sub_ui(modulus, modulus, 1);
+    for (size_t i = 0; i < 2; ++i) {
+        mpz_init(xs[i]);
+        mpz_ui_pow_ui(xs[i], 3, 400 + i);
+        mpz_init(rops[i]);
+    }
+    acirc_plan *plan = acirc_plan_new(c);
+    acirc_pool *pool = acirc_pool_new(2);
+    acirc_rns *rns = acirc_rns_new(plan, modulus);
+    if (rns == NULL)
+        result = false;
+    for (int par = 0; rns && par < 2; ++par) {
+        if (acirc_eval_rns(par ? pool : NULL, rns, rops, xs, ys) != ACIRC_OK)
+            result = false;
+        for (size_t i = 0; i < 2; ++i) {
+            acirc_eval_mpz_mod(expected, c, c->outputs.buf[i], xs, ys, modulus);
+            if (mpz_cmp(rops[i], expected) != 0)
+                result = false;
+        }
+    }
+    acirc_mpz_ctx *ctx = acirc_mpz_ctx_new(plan, modulus);
+    for (int rep = 0; rep < 3; ++rep) {
+        const int ret = rep < 2 ? acirc_eval_mpz_ctx(ctx, rops, xs, ys)
+            : acirc_eval_mpz_mod_par(pool, plan, rops, xs, ys, modulus);
+        if (ret != ACIRC_OK)
+            result = false;
+        for (size_t i = 0; i < 2; ++i) {
+            acirc_eval_mpz_mod(expected, c, c->outputs.buf[i], xs, ys, modulus);
+            if (mpz_cmp(rops[i], expected) != 0)
+                result = false;
+        }
+    }
+    acirc_mpz_ctx_free(ctx);
+    /* and so does the mpn backend, with odd and even moduli */
+    for (int even = 0; even < 2; ++even) {
+        if (even)
+            mpz_add_ui(modulus, modulus, 1);
+        acirc_mpn_ctx *mpn = acirc_mpn_ctx_new(plan, modulus);
+        if (acirc_eval_mpn(mpn, rops, xs, ys) != ACIRC_OK)
+            result = false;
+        for (size_t i = 0; i < 2; ++i) {
+            acirc_eval_mpz_mod(expected, c, c->outputs.buf[i], xs, ys, modulus);
+            if (mpz_cmp(rops[i], expected) != 0)
+                result = false;
+        }
+        acirc_mpn_ctx_free(mpn);
+    }
+    acirc_rns_free(rns);
+    acirc_plan_free(plan);
+
+    /* outputs that copy an input or a constant come back as given, even
+     * when they are not reduced */
+    acirc copies;
+    acirc_init(&copies);
+    acirc_add_input(&copies, 0, 0);
+    acirc_add_const(&copies, 1, 5);
+    acircref set[1] = {1};
+    acirc_add_gate(&copies, 2, OP_SET, set, 1);
+    acirc_add_output(&copies, 0);
+    acirc_add_output(&copies, 2);
+    mpz_set_ui(modulus, 3);
+    plan = acirc_plan_new(&copies);
+    ctx = acirc_mpz_ctx_new(plan, modulus);
+    for (int rep = 0; rep < 2; ++rep) {
+        const int ret = rep == 0 ? acirc_eval_mpz_ctx(ctx, rops, xs, ys)
+            : acirc_eval_mpz_mod_par(pool, plan, rops, xs, ys, modulus);
+        if (ret != ACIRC_OK || mpz_cmp(rops[0], xs[0]) != 0 || mpz_cmp(rops[1], ys[0]) != 0)
+            result = false;
+        for (size_t i = 0; i < 2; ++i) {
+            acirc_eval_mpz_mod(expected, &copies, copies.outputs.buf[i], xs, ys, modulus);
+            if (mpz_cmp(rops[i], expected) != 0)
+                result = false;
+        }
+    }
+    acirc_mpz_ctx_free(ctx);
+    acirc_plan_free(plan);
+    acirc_clear(&copies);
+    acirc_pool_free(pool);
+    for (size_t i = 0; i < 2; ++i)
+        mpz_clears(xs[i], rops[i], NULL);
+    mpz_clears(ys[0], modulus, expected, NULL);
+    acirc_clear(c);
+    free(c);
+
     return !result;
 }